@@ -0,0 +1,49 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _CELL_KEY_H_
+#define _CELL_KEY_H_
+#include "partition.h"
+#include <array>
+#include <cstdint>
+
+// Bucket ids of the grid partitions: three cell coordinates packed in k_axis_bits each.
+namespace cell_key {
+    constexpr uint32_t k_axis_bits = 21;
+    constexpr uint32_t k_max_value = 1u << k_axis_bits;
+
+    inline partition::cell_id pack(const uint32_t a, const uint32_t b, const uint32_t c) {
+        return static_cast<partition::cell_id>(a) << (2 * k_axis_bits) | static_cast<partition::cell_id>(b) << k_axis_bits | c;
+    }
+
+    inline std::array<uint32_t, 3> unpack(const partition::cell_id value) {
+        const partition::cell_id mask = k_max_value - 1;
+        return {{
+            static_cast<uint32_t>((value >> (2 * k_axis_bits)) & mask),
+            static_cast<uint32_t>((value >> k_axis_bits) & mask),
+            static_cast<uint32_t>(value & mask)
+        }};
+    }
+}
+
+#endif // _CELL_KEY_H_
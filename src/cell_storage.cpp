@@ -0,0 +1,216 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "cell_storage.h"
+#include <simple-assert.h>
+#include <algorithm>
+
+static const uint32_t k_min_cell_capacity = 4;
+// A rebuild touches every entry and cell once, an add/remove may relocate a cell. Past this share
+// of changed entries the rebuild wins.
+static const size_t k_rebuild_divisor = 4;
+cell_storage::cell_storage(const size_t cell_count, const bool store_positions)
+    : m_cells(cell_count)
+    , m_store_positions(store_positions) {}
+
+void cell_storage::add(const size_t cell_idx, const size_t external_idx) {
+    SPL_ASSERT(!m_store_positions, "Positions are stored, add them too");
+    auto& c = m_cells[cell_idx];
+    if (c.count == c.capacity) {
+        grow_cell(c);
+    }
+    set_slot(external_idx, c.count);
+    m_pool[c.offset + c.count++] = external_idx;
+    m_size++;
+}
+
+void cell_storage::add(const size_t cell_idx, const size_t external_idx, const glm::vec3& pos) {
+    auto& c = m_cells[cell_idx];
+    if (c.count == c.capacity) {
+        grow_cell(c);
+    }
+    set_slot(external_idx, c.count);
+    set_position(c.offset + c.count, pos);
+    m_pool[c.offset + c.count++] = external_idx;
+    m_size++;
+}
+
+void cell_storage::remove(const size_t cell_idx, const size_t external_idx) {
+    auto& c = m_cells[cell_idx];
+    SPL_ASSERT(external_idx < m_slots.size(), "The index was never added");
+    const auto slot = m_slots[external_idx];
+    SPL_ASSERT(slot < c.count && m_pool[c.offset + slot] == external_idx, "The index was not found in the bucket");
+    // Swap with the last one of the cell, the order within a cell is irrelevant.
+    const auto last = c.offset + c.count - 1;
+    const auto moved = m_pool[last];
+    m_pool[c.offset + slot] = moved;
+    if (m_store_positions) {
+        m_pool_x[c.offset + slot] = m_pool_x[last];
+        m_pool_y[c.offset + slot] = m_pool_y[last];
+        m_pool_z[c.offset + slot] = m_pool_z[last];
+    }
+    m_slots[moved] = slot;
+    c.count--;
+    m_size--;
+}
+
+cell_storage::bucket_view cell_storage::get(const size_t cell_idx) const {
+    const auto& c = m_cells[cell_idx];
+    const auto first = m_pool.data() + c.offset;
+    if (!m_store_positions) {
+        return bucket_view{ first, first + c.count, nullptr, nullptr, nullptr };
+    }
+    return bucket_view{ first, first + c.count, m_pool_x.data() + c.offset, m_pool_y.data() + c.offset, m_pool_z.data() + c.offset };
+}
+
+void cell_storage::add_cells(const size_t cell_count) {
+    m_cells.resize(m_cells.size() + cell_count);
+}
+
+void cell_storage::rebuild(const std::vector<size_t>& cell_idxs, const std::vector<size_t>& external_idxs) {
+    SPL_ASSERT(!m_store_positions, "Positions are stored, pass them too");
+    rebuild(cell_idxs, external_idxs, nullptr);
+}
+
+void cell_storage::rebuild(const std::vector<size_t>& cell_idxs, const std::vector<size_t>& external_idxs, const std::vector<glm::vec3>& positions) {
+    SPL_ASSERT(cell_idxs.size() == positions.size(), "Every cell index needs a position.");
+    rebuild(cell_idxs, external_idxs, m_store_positions ? &positions : nullptr);
+}
+
+bool cell_storage::should_rebuild(const size_t changed_count) const {
+    return changed_count * k_rebuild_divisor > m_size;
+}
+
+void cell_storage::rebuild(const std::vector<size_t>& cell_idxs, const std::vector<size_t>& external_idxs, const std::vector<glm::vec3>* positions) {
+    SPL_ASSERT(cell_idxs.size() == external_idxs.size(), "Every cell index needs an external index.");
+    // Histogram.
+    for (auto& c : m_cells) {
+        c.count = 0;
+    }
+    for (auto cell_idx : cell_idxs) {
+        m_cells[cell_idx].count++;
+    }
+
+    // Prefix sum, leaving some room on every occupied cell for later adds.
+    uint32_t offset = 0;
+    for (auto& c : m_cells) {
+        c.offset = offset;
+        c.capacity = (c.count == 0) ? 0 : std::max(k_min_cell_capacity, c.count + c.count / 4);
+        offset += c.capacity;
+        c.count = 0;
+    }
+
+    // Scatter.
+    m_pool.clear();
+    m_pool_x.clear();
+    m_pool_y.clear();
+    m_pool_z.clear();
+    resize_pool(offset);
+    for (size_t ix = 0; ix < cell_idxs.size(); ix++) {
+        auto& c = m_cells[cell_idxs[ix]];
+        set_slot(external_idxs[ix], c.count);
+        if (positions) {
+            set_position(c.offset + c.count, (*positions)[ix]);
+        }
+        m_pool[c.offset + c.count++] = external_idxs[ix];
+    }
+    m_pool_waste = 0;
+    m_size = cell_idxs.size();
+}
+
+void cell_storage::set_slot(const size_t external_idx, const uint32_t slot) {
+    if (external_idx >= m_slots.size()) {
+        m_slots.resize(external_idx + 1);
+    }
+    m_slots[external_idx] = slot;
+}
+
+void cell_storage::set_position(const size_t pool_idx, const glm::vec3& pos) {
+    if (m_store_positions) {
+        m_pool_x[pool_idx] = pos.x;
+        m_pool_y[pool_idx] = pos.y;
+        m_pool_z[pool_idx] = pos.z;
+    }
+}
+
+void cell_storage::resize_pool(const size_t size) {
+    m_pool.resize(size);
+    if (m_store_positions) {
+        m_pool_x.resize(size);
+        m_pool_y.resize(size);
+        m_pool_z.resize(size);
+    }
+}
+
+void cell_storage::grow_cell(cell& c) {
+    // Relocate the cell to the end of the pool with twice the room, the old range becomes waste.
+    // Once waste dominates the pool everything is packed again.
+    if (m_pool_waste > m_pool.size() / 2) {
+        compact_pool();
+    }
+    const auto new_capacity = std::max(k_min_cell_capacity, 2 * c.capacity);
+    const auto new_offset = static_cast<uint32_t>(m_pool.size());
+    resize_pool(m_pool.size() + new_capacity);
+    move_cell_range(m_pool, c, new_offset);
+    if (m_store_positions) {
+        move_cell_range(m_pool_x, c, new_offset);
+        move_cell_range(m_pool_y, c, new_offset);
+        move_cell_range(m_pool_z, c, new_offset);
+    }
+    m_pool_waste += c.capacity;
+    c.offset = new_offset;
+    c.capacity = new_capacity;
+}
+
+void cell_storage::compact_pool() {
+    std::vector<uint32_t> offsets(m_cells.size());
+    uint32_t offset = 0;
+    for (size_t cix = 0; cix < m_cells.size(); cix++) {
+        offsets[cix] = offset;
+        offset += m_cells[cix].capacity;
+    }
+    repack(m_pool, offsets, offset);
+    if (m_store_positions) {
+        repack(m_pool_x, offsets, offset);
+        repack(m_pool_y, offsets, offset);
+        repack(m_pool_z, offsets, offset);
+    }
+    for (size_t cix = 0; cix < m_cells.size(); cix++) {
+        m_cells[cix].offset = offsets[cix];
+    }
+    m_pool_waste = 0;
+}
+
+template <typename T>
+void cell_storage::move_cell_range(std::vector<T>& pool, const cell& c, const uint32_t new_offset) const {
+    std::copy(pool.begin() + c.offset, pool.begin() + c.offset + c.count, pool.begin() + new_offset);
+}
+
+template <typename T>
+void cell_storage::repack(std::vector<T>& pool, const std::vector<uint32_t>& offsets, const size_t size) const {
+    std::vector<T> packed(size);
+    for (size_t cix = 0; cix < m_cells.size(); cix++) {
+        const auto& c = m_cells[cix];
+        std::copy(pool.begin() + c.offset, pool.begin() + c.offset + c.count, packed.begin() + offsets[cix]);
+    }
+    pool.swap(packed);
+}
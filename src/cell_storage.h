@@ -0,0 +1,98 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CELL_STORAGE_H_
+#define _CELL_STORAGE_H_
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Dense array of cells, every cell's external indices are stored as a contiguous range of a single
+// shared pool. Cells are addressed by their index in the array, mapping positions to cells is up to
+// the owner. Optionally a copy of every entry's position is kept next to its index, so scans over a
+// cell read contiguous coordinates instead of jumping to the owner's arrays.
+class cell_storage {
+public:
+    // Read-only view over the external indices of a cell. Invalidated by add() and rebuild().
+    struct bucket_view {
+        const size_t* first;
+        const size_t* last;
+        // Coordinates of every entry, in the same order. Null unless positions are stored.
+        const float* x;
+        const float* y;
+        const float* z;
+
+        const size_t* begin() const { return first; }
+        const size_t* end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+        bool empty() const { return first == last; }
+    };
+
+    explicit cell_storage(size_t cell_count, bool store_positions = false);
+    ~cell_storage() = default;
+
+    void add(size_t cell_idx, size_t external_idx);
+    void add(size_t cell_idx, size_t external_idx, const glm::vec3& pos);
+    void remove(size_t cell_idx, size_t external_idx);
+    bucket_view get(size_t cell_idx) const;
+    uint32_t count(size_t cell_idx) const { return m_cells[cell_idx].count; }
+    // Appends empty cells at the end of the array.
+    void add_cells(size_t cell_count);
+
+    // Drops the current contents and bulk loads external_idxs[i] into cell_idxs[i], building the
+    // pool as a counting sort (histogram, prefix sum and scatter).
+    void rebuild(const std::vector<size_t>& cell_idxs, const std::vector<size_t>& external_idxs);
+    void rebuild(const std::vector<size_t>& cell_idxs, const std::vector<size_t>& external_idxs, const std::vector<glm::vec3>& positions);
+    // Whether a rebuild is expected to be cheaper than changed_count incremental add/remove calls.
+    bool should_rebuild(size_t changed_count) const;
+    size_t size() const { return m_size; }
+    size_t cell_count() const { return m_cells.size(); }
+    bool stores_positions() const { return m_store_positions; }
+private:
+    struct cell {
+        uint32_t offset = 0;
+        uint32_t count = 0;
+        uint32_t capacity = 0;
+    };
+
+    std::vector<cell> m_cells;
+    std::vector<size_t> m_pool;
+    std::vector<float> m_pool_x, m_pool_y, m_pool_z; // Parallel to m_pool, empty unless m_store_positions.
+    bool m_store_positions;
+    std::vector<uint32_t> m_slots; // Position of each external index within its cell.
+    size_t m_pool_waste = 0; // Pool slots left behind by cells that had to be relocated.
+    size_t m_size = 0;
+
+    void set_slot(size_t external_idx, uint32_t slot);
+    void set_position(size_t pool_idx, const glm::vec3& pos);
+    void rebuild(const std::vector<size_t>& cell_idxs, const std::vector<size_t>& external_idxs, const std::vector<glm::vec3>* positions);
+    void resize_pool(size_t size);
+    void grow_cell(cell& c);
+    void compact_pool();
+    template <typename T>
+    void move_cell_range(std::vector<T>& pool, const cell& c, uint32_t new_offset) const;
+    template <typename T>
+    void repack(std::vector<T>& pool, const std::vector<uint32_t>& offsets, size_t size) const;
+};
+
+#endif // _CELL_STORAGE_H_
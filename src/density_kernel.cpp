@@ -0,0 +1,219 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "density_kernel.h"
+#include <simple-assert.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DENSITY_KERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DENSITY_KERNEL_TARGET(isa)
+#else
+#define DENSITY_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace {
+    using count_fn = uint32_t (*)(const float*, const float*, const float*, size_t, const glm::vec3&, float);
+    using mask_fn = uint64_t (*)(const float*, const float*, const float*, size_t, const glm::vec3&, float);
+
+    uint32_t count_within_scalar(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+        uint32_t result = 0;
+        for (size_t ix = 0; ix < count; ix++) {
+            const auto dx = x[ix] - pos.x;
+            const auto dy = y[ix] - pos.y;
+            const auto dz = z[ix] - pos.z;
+            result += (dx * dx + dy * dy + dz * dz < threshold2);
+        }
+        return result;
+    }
+
+    uint64_t mask_within_scalar(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+        uint64_t result = 0;
+        for (size_t ix = 0; ix < count; ix++) {
+            const auto dx = x[ix] - pos.x;
+            const auto dy = y[ix] - pos.y;
+            const auto dz = z[ix] - pos.z;
+            result |= static_cast<uint64_t>(dx * dx + dy * dy + dz * dz < threshold2) << ix;
+        }
+        return result;
+    }
+
+#ifdef DENSITY_KERNEL_X86
+    DENSITY_KERNEL_TARGET("sse2")
+    uint32_t count_within_sse2(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+        const auto px = _mm_set1_ps(pos.x);
+        const auto py = _mm_set1_ps(pos.y);
+        const auto pz = _mm_set1_ps(pos.z);
+        const auto t2 = _mm_set1_ps(threshold2);
+        // Every lane of acc counts down by one per hit, the compare mask being -1.
+        auto acc = _mm_setzero_si128();
+        size_t ix = 0;
+        for (; ix + 4 <= count; ix += 4) {
+            const auto dx = _mm_sub_ps(_mm_loadu_ps(x + ix), px);
+            const auto dy = _mm_sub_ps(_mm_loadu_ps(y + ix), py);
+            const auto dz = _mm_sub_ps(_mm_loadu_ps(z + ix), pz);
+            const auto d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            acc = _mm_sub_epi32(acc, _mm_castps_si128(_mm_cmplt_ps(d2, t2)));
+        }
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_within_scalar(x + ix, y + ix, z + ix, count - ix, pos, threshold2);
+    }
+
+    DENSITY_KERNEL_TARGET("avx2")
+    uint32_t count_within_avx2(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+        const auto px = _mm256_set1_ps(pos.x);
+        const auto py = _mm256_set1_ps(pos.y);
+        const auto pz = _mm256_set1_ps(pos.z);
+        const auto t2 = _mm256_set1_ps(threshold2);
+        auto acc = _mm256_setzero_si256();
+        size_t ix = 0;
+        for (; ix + 8 <= count; ix += 8) {
+            const auto dx = _mm256_sub_ps(_mm256_loadu_ps(x + ix), px);
+            const auto dy = _mm256_sub_ps(_mm256_loadu_ps(y + ix), py);
+            const auto dz = _mm256_sub_ps(_mm256_loadu_ps(z + ix), pz);
+            const auto d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            acc = _mm256_sub_epi32(acc, _mm256_castps_si256(_mm256_cmp_ps(d2, t2, _CMP_LT_OQ)));
+        }
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        uint32_t result = 0;
+        for (auto lane : lanes) {
+            result += lane;
+        }
+        return result + count_within_sse2(x + ix, y + ix, z + ix, count - ix, pos, threshold2);
+    }
+
+    DENSITY_KERNEL_TARGET("sse2")
+    uint64_t mask_within_sse2(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+        const auto px = _mm_set1_ps(pos.x);
+        const auto py = _mm_set1_ps(pos.y);
+        const auto pz = _mm_set1_ps(pos.z);
+        const auto t2 = _mm_set1_ps(threshold2);
+        uint64_t result = 0;
+        size_t ix = 0;
+        for (; ix + 4 <= count; ix += 4) {
+            const auto dx = _mm_sub_ps(_mm_loadu_ps(x + ix), px);
+            const auto dy = _mm_sub_ps(_mm_loadu_ps(y + ix), py);
+            const auto dz = _mm_sub_ps(_mm_loadu_ps(z + ix), pz);
+            const auto d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            result |= static_cast<uint64_t>(_mm_movemask_ps(_mm_cmplt_ps(d2, t2))) << ix;
+        }
+        if (ix < count) {
+            // Also keeps the shift below 64 when the whole block went through the vector loop.
+            result |= mask_within_scalar(x + ix, y + ix, z + ix, count - ix, pos, threshold2) << ix;
+        }
+        return result;
+    }
+
+    DENSITY_KERNEL_TARGET("avx2")
+    uint64_t mask_within_avx2(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+        const auto px = _mm256_set1_ps(pos.x);
+        const auto py = _mm256_set1_ps(pos.y);
+        const auto pz = _mm256_set1_ps(pos.z);
+        const auto t2 = _mm256_set1_ps(threshold2);
+        uint64_t result = 0;
+        size_t ix = 0;
+        for (; ix + 8 <= count; ix += 8) {
+            const auto dx = _mm256_sub_ps(_mm256_loadu_ps(x + ix), px);
+            const auto dy = _mm256_sub_ps(_mm256_loadu_ps(y + ix), py);
+            const auto dz = _mm256_sub_ps(_mm256_loadu_ps(z + ix), pz);
+            const auto d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            result |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(d2, t2, _CMP_LT_OQ))) << ix;
+        }
+        if (ix < count) {
+            result |= mask_within_sse2(x + ix, y + ix, z + ix, count - ix, pos, threshold2) << ix;
+        }
+        return result;
+    }
+#endif
+
+    density_kernel::isa detect_isa() {
+#ifdef DENSITY_KERNEL_X86
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuid(regs, 0);
+        const auto max_leaf = regs[0];
+        __cpuid(regs, 1);
+        const bool sse2 = (regs[3] & (1 << 26)) != 0;
+        // AVX2 also needs the OS to save the ymm registers.
+        const bool os_ymm = (regs[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+        bool avx2 = false;
+        if (max_leaf >= 7 && os_ymm) {
+            __cpuidex(regs, 7, 0);
+            avx2 = (regs[1] & (1 << 5)) != 0;
+        }
+#else
+        __builtin_cpu_init();
+        const bool sse2 = __builtin_cpu_supports("sse2");
+        const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+        if (avx2) {
+            return density_kernel::isa::AVX2;
+        }
+        if (sse2) {
+            return density_kernel::isa::SSE2;
+        }
+#endif
+        return density_kernel::isa::SCALAR;
+    }
+
+    count_fn select_count_fn(const density_kernel::isa isa) {
+        switch (isa) {
+#ifdef DENSITY_KERNEL_X86
+            case density_kernel::isa::AVX2: return count_within_avx2;
+            case density_kernel::isa::SSE2: return count_within_sse2;
+#endif
+            default: return count_within_scalar;
+        }
+    }
+
+    mask_fn select_mask_fn(const density_kernel::isa isa) {
+        switch (isa) {
+#ifdef DENSITY_KERNEL_X86
+            case density_kernel::isa::AVX2: return mask_within_avx2;
+            case density_kernel::isa::SSE2: return mask_within_sse2;
+#endif
+            default: return mask_within_scalar;
+        }
+    }
+}
+
+density_kernel::isa density_kernel::get_isa() {
+    static const auto isa = detect_isa();
+    return isa;
+}
+
+uint32_t density_kernel::count_within(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+    static const auto count_within_impl = select_count_fn(get_isa());
+    return count_within_impl(x, y, z, count, pos, threshold2);
+}
+
+uint64_t density_kernel::mask_within(const float* x, const float* y, const float* z, const size_t count, const glm::vec3& pos, const float threshold2) {
+    SPL_ASSERT(count <= k_max_mask_count, "Too many points for the mask.");
+    static const auto mask_within_impl = select_mask_fn(get_isa());
+    return mask_within_impl(x, y, z, count, pos, threshold2);
+}
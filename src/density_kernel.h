@@ -0,0 +1,72 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _DENSITY_KERNEL_H_
+#define _DENSITY_KERNEL_H_
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace density_kernel {
+    enum class isa {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    // Widest instruction set supported by the running CPU, checked once.
+    isa get_isa();
+
+    // Number of the count points (x[i], y[i], z[i]) whose squared distance to pos is below
+    // threshold2. Gives the same answer as the scalar test on every path: no fused multiply-add,
+    // same operation order.
+    uint32_t count_within(const float* x, const float* y, const float* z, size_t count, const glm::vec3& pos, float threshold2);
+
+    static constexpr size_t k_max_mask_count = 64;
+    // Same test as count_within for up to k_max_mask_count points, bit i set when point i is within.
+    uint64_t mask_within(const float* x, const float* y, const float* z, size_t count, const glm::vec3& pos, float threshold2);
+
+    // Index of the lowest set bit, mask can't be 0.
+    inline uint32_t lowest_bit(const uint64_t mask) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long ix;
+        _BitScanForward64(&ix, mask);
+        return static_cast<uint32_t>(ix);
+#elif defined(_MSC_VER)
+        // No 64 bit scan on 32 bit targets, one half at a time.
+        unsigned long ix;
+        if (_BitScanForward(&ix, static_cast<unsigned long>(mask))) {
+            return static_cast<uint32_t>(ix);
+        }
+        _BitScanForward(&ix, static_cast<unsigned long>(mask >> 32));
+        return static_cast<uint32_t>(ix) + 32;
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(mask));
+#endif
+    }
+}
+
+#endif // _DENSITY_KERNEL_H_
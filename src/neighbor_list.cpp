@@ -0,0 +1,89 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "neighbor_list.h"
+#include <simple-assert.h>
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+#include <cmath>
+
+static uint32_t interval_count(const float min_val, const float max_val, const float reach) {
+    // Cells at least as big as the list reach, so the 3x3x3 area covers it.
+    const auto intervals = static_cast<uint32_t>(std::floor((max_val - min_val) / reach));
+    return std::max(1u, std::min(intervals, spp::k_max_dense_intervals_per_axis));
+}
+
+neighbor_list::neighbor_list(const float min_val, const float max_val, const float radius, const float skin)
+    : m_grid(interval_count(min_val, max_val, radius + skin), min_val, max_val, spp::cell_order::MORTON, spp::cell_content::POSITIONS)
+    , m_radius(radius)
+    , m_skin(skin) {
+    SPL_ASSERT(radius > 0.f && skin >= 0.f, "The radius has to be positive, the skin can't be negative.");
+}
+
+void neighbor_list::build(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) {
+    SPL_ASSERT(positions.size() == external_idxs.size(), "Every position needs an external index.");
+    const auto bucket_ids = m_grid.rebuild(positions, external_idxs);
+    const auto reach = m_radius + m_skin;
+    const auto reach2 = reach * reach;
+
+    m_offsets.assign(1, 0);
+    m_offsets.reserve(positions.size() + 1);
+    m_neighbors.clear();
+    spp::bucket_area area;
+    for (size_t entry = 0; entry < positions.size(); entry++) {
+        const auto& pos = positions[entry];
+        m_grid.get_buckets_area(bucket_ids[entry], area);
+        for (auto bucket_id : area) {
+            const auto bucket = m_grid.get_bucket(bucket_id);
+            for (size_t k = 0; k < bucket.size(); k++) {
+                const auto dx = bucket.x[k] - pos.x;
+                const auto dy = bucket.y[k] - pos.y;
+                const auto dz = bucket.z[k] - pos.z;
+                if (bucket.first[k] != external_idxs[entry] && dx * dx + dy * dy + dz * dz < reach2) {
+                    m_neighbors.push_back(bucket.first[k]);
+                }
+            }
+        }
+        m_offsets.push_back(m_neighbors.size());
+    }
+    m_reference = positions;
+}
+
+bool neighbor_list::needs_rebuild(const std::vector<glm::vec3>& positions) const {
+    SPL_ASSERT(positions.size() == m_reference.size(), "The lists were built for another set of particles.");
+    // Two particles each moving half the skin towards each other is the most a pair can close in.
+    const auto half_skin = .5f * m_skin;
+    const auto half_skin2 = half_skin * half_skin;
+    for (size_t entry = 0; entry < positions.size(); entry++) {
+        if (glm::distance2(positions[entry], m_reference[entry]) > half_skin2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+neighbor_list::neighbors_view neighbor_list::get_neighbors(const size_t entry) const {
+    SPL_ASSERT(entry + 1 < m_offsets.size(), "Entry out of range.");
+    const auto first = m_neighbors.data() + m_offsets[entry];
+    return neighbors_view{ first, m_neighbors.data() + m_offsets[entry + 1] };
+}
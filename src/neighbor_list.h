@@ -0,0 +1,67 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _NEIGHBOR_LIST_H_
+#define _NEIGHBOR_LIST_H_
+#include "spp.h"
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <vector>
+
+// Verlet neighbor lists for particles that move. Every entry keeps the particles closer than radius
+// plus a skin margin at the time of the build, so while no particle has moved more than half the
+// skin the lists still hold every pair closer than radius, and the grid isn't queried again.
+class neighbor_list {
+public:
+    // External indices of the neighbors of an entry.
+    struct neighbors_view {
+        const size_t* first;
+        const size_t* last;
+
+        const size_t* begin() const { return first; }
+        const size_t* end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+        bool empty() const { return first == last; }
+    };
+
+    neighbor_list(float min_val, float max_val, float radius, float skin);
+    ~neighbor_list() = default;
+
+    // Builds the lists of every external_idxs[i] at positions[i], entry i being that particle.
+    void build(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs);
+    // Whether a particle moved more than half the skin since the build, positions in entry order.
+    bool needs_rebuild(const std::vector<glm::vec3>& positions) const;
+    // Candidates for the entry, the caller still tests the distance against the radius.
+    neighbors_view get_neighbors(size_t entry) const;
+    size_t size() const { return m_reference.size(); }
+    float get_radius() const { return m_radius; }
+private:
+    spp m_grid;
+    float m_radius;
+    float m_skin;
+    std::vector<size_t> m_offsets; // Entry i owns [m_offsets[i], m_offsets[i + 1]) of m_neighbors.
+    std::vector<size_t> m_neighbors;
+    std::vector<glm::vec3> m_reference; // Positions at the last build.
+};
+
+#endif // _NEIGHBOR_LIST_H_
@@ -0,0 +1,222 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "opp.h"
+#include <simple-assert.h>
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+opp::opp(const float min_val, const float max_val, const float radius, const uint32_t leaf_capacity)
+    : m_storage(1)
+    , m_radius(radius)
+    , m_leaf_capacity(leaf_capacity) {
+    SPL_ASSERT(max_val > min_val, "Consider swapping min and max!");
+    SPL_ASSERT(radius > 0.f, "OPP radius has to be positive.");
+    SPL_ASSERT(leaf_capacity > 0, "OPP leaves have to hold something.");
+    node root;
+    root.min = glm::vec3{ min_val, min_val, min_val };
+    root.size = max_val - min_val;
+    root.depth = 0;
+    m_nodes.push_back(root);
+}
+
+opp::cell_id opp::add(const glm::vec3& pos, const size_t external_idx) {
+    const auto leaf = find_leaf(pos);
+    m_storage.add(leaf, external_idx);
+    track(external_idx, leaf, pos);
+    if (m_storage.count(leaf) > m_leaf_capacity && can_split(leaf)) {
+        split(leaf);
+    }
+    return m_leaf_of[external_idx];
+}
+
+void opp::remove(const cell_id /*bucket_id*/, const size_t external_idx) {
+    // The given bucket may be an inner node by now, the leaf is tracked instead.
+    SPL_ASSERT(external_idx < m_leaf_of.size(), "The index was never added");
+    m_storage.remove(m_leaf_of[external_idx], external_idx);
+}
+
+void opp::visit_buckets_area(const cell_id bucket_id, const bucket_visitor& visit) const {
+    SPL_ASSERT(bucket_id < m_nodes.size(), "The bucket is not within OPP bounds.");
+    const auto& area_node = m_nodes[static_cast<size_t>(bucket_id)];
+    const auto area_min = area_node.min - m_radius;
+    const auto area_max = area_node.min + area_node.size + m_radius;
+
+    // Every pop pushes at most 8 children one level deeper.
+    std::array<uint32_t, 7 * k_max_depth + 8> stack;
+    size_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const auto node_idx = stack[--top];
+        const auto& n = m_nodes[node_idx];
+        const auto n_max = n.min + n.size;
+        if (n.min.x > area_max.x || n.min.y > area_max.y || n.min.z > area_max.z ||
+            n_max.x < area_min.x || n_max.y < area_min.y || n_max.z < area_min.z) {
+            continue;
+        }
+        if (n.first_child == k_no_children) {
+            if (m_storage.count(node_idx) != 0) {
+                visit(node_idx);
+            }
+        } else {
+            for (uint32_t c = 0; c < 8; c++) {
+                stack[top++] = n.first_child + c;
+            }
+        }
+    }
+}
+
+opp::bucket_view opp::get_bucket(const cell_id bucket_id) const {
+    SPL_ASSERT(bucket_id < m_nodes.size(), "The bucket is not within OPP bounds.");
+    return m_storage.get(static_cast<size_t>(bucket_id));
+}
+
+std::vector<opp::cell_id> opp::rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) {
+    SPL_ASSERT(positions.size() == external_idxs.size(), "Every position needs an external index.");
+    reset();
+    // Split top-down first, then bulk load the final leaves.
+    std::vector<cell_id> leaves(positions.size());
+    std::vector<size_t> items(positions.size());
+    std::iota(items.begin(), items.end(), 0);
+    build(0, items.data(), items.data() + items.size(), positions, leaves);
+
+    m_storage = cell_storage{ m_nodes.size() };
+    std::vector<size_t> cell_idxs(leaves.begin(), leaves.end());
+    m_storage.rebuild(cell_idxs, external_idxs);
+    for (size_t ix = 0; ix < positions.size(); ix++) {
+        track(external_idxs[ix], static_cast<uint32_t>(leaves[ix]), positions[ix]);
+    }
+    return leaves;
+}
+
+bool opp::should_rebuild(const size_t changed_count) const {
+    return m_storage.should_rebuild(changed_count);
+}
+
+void opp::reset() {
+    node root = m_nodes.front();
+    root.first_child = k_no_children;
+    m_nodes.assign(1, root);
+    m_storage = cell_storage{ 1 };
+}
+
+uint32_t opp::find_leaf(const glm::vec3& pos) const {
+    const auto& root = m_nodes.front();
+    SPL_ASSERT(pos.x <= root.min.x + root.size && pos.x >= root.min.x, "pos.x is not within OPP bounds.");
+    SPL_ASSERT(pos.y <= root.min.y + root.size && pos.y >= root.min.y, "pos.y is not within OPP bounds.");
+    SPL_ASSERT(pos.z <= root.min.z + root.size && pos.z >= root.min.z, "pos.z is not within OPP bounds.");
+    uint32_t node_idx = 0;
+    while (m_nodes[node_idx].first_child != k_no_children) {
+        node_idx = get_child(m_nodes[node_idx], pos);
+    }
+    return node_idx;
+}
+
+uint32_t opp::get_child(const node& n, const glm::vec3& pos) const {
+    const auto center = n.min + n.size / 2.f;
+    return n.first_child +
+        ((pos.x >= center.x) ? 4 : 0) +
+        ((pos.y >= center.y) ? 2 : 0) +
+        ((pos.z >= center.z) ? 1 : 0);
+}
+
+bool opp::can_split(const uint32_t node_idx) const {
+    // Children smaller than the radius only make areas visit more leaves.
+    const auto& n = m_nodes[node_idx];
+    return n.depth < k_max_depth && n.size / 2.f >= m_radius;
+}
+
+void opp::create_children(const uint32_t node_idx) {
+    // Adding the children can reallocate the nodes, keep a copy of the parent.
+    const auto parent = m_nodes[node_idx];
+    const auto half = parent.size / 2.f;
+    const auto first_child = static_cast<uint32_t>(m_nodes.size());
+    for (uint32_t c = 0; c < 8; c++) {
+        node child;
+        child.min = parent.min + glm::vec3{ (c & 4) ? half : 0.f, (c & 2) ? half : 0.f, (c & 1) ? half : 0.f };
+        child.size = half;
+        child.depth = parent.depth + 1;
+        m_nodes.push_back(child);
+    }
+    m_nodes[node_idx].first_child = first_child;
+}
+
+void opp::split(const uint32_t node_idx) {
+    create_children(node_idx);
+    m_storage.add_cells(8);
+
+    const auto bucket = m_storage.get(node_idx);
+    const std::vector<size_t> members(bucket.begin(), bucket.end());
+    for (auto external_idx : members) {
+        const auto child = get_child(m_nodes[node_idx], m_positions[external_idx]);
+        m_storage.remove(node_idx, external_idx);
+        m_storage.add(child, external_idx);
+        m_leaf_of[external_idx] = child;
+    }
+
+    // Clustered particles may all land in the same child.
+    const auto first_child = m_nodes[node_idx].first_child;
+    for (uint32_t c = 0; c < 8; c++) {
+        if (m_storage.count(first_child + c) > m_leaf_capacity && can_split(first_child + c)) {
+            split(first_child + c);
+        }
+    }
+}
+
+void opp::build(const uint32_t node_idx, size_t* const first, size_t* const last, const std::vector<glm::vec3>& positions, std::vector<cell_id>& leaves) {
+    const auto count = static_cast<size_t>(last - first);
+    if (count <= m_leaf_capacity || !can_split(node_idx)) {
+        for (auto it = first; it != last; it++) {
+            leaves[*it] = node_idx;
+        }
+        return;
+    }
+
+    create_children(node_idx);
+    // Group the items by child with a counting sort.
+    std::array<size_t, 9> offsets{};
+    for (auto it = first; it != last; it++) {
+        offsets[get_child(m_nodes[node_idx], positions[*it]) - m_nodes[node_idx].first_child + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<size_t> grouped(count);
+    auto cursors = offsets;
+    for (auto it = first; it != last; it++) {
+        grouped[cursors[get_child(m_nodes[node_idx], positions[*it]) - m_nodes[node_idx].first_child]++] = *it;
+    }
+    std::copy(grouped.begin(), grouped.end(), first);
+
+    const auto first_child = m_nodes[node_idx].first_child;
+    for (uint32_t c = 0; c < 8; c++) {
+        build(first_child + c, first + offsets[c], first + offsets[c + 1], positions, leaves);
+    }
+}
+
+void opp::track(const size_t external_idx, const uint32_t leaf, const glm::vec3& pos) {
+    if (external_idx >= m_leaf_of.size()) {
+        m_leaf_of.resize(external_idx + 1);
+        m_positions.resize(external_idx + 1);
+    }
+    m_leaf_of[external_idx] = leaf;
+    m_positions[external_idx] = pos;
+}
@@ -0,0 +1,79 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _OPP_H_
+#define _OPP_H_
+#include "cell_storage.h"
+#include "partition.h"
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Octree Partitioned Positions!
+// Adaptive octree over a cube, leaves split once they hold more than leaf_capacity particles, so
+// clustered distributions keep a bounded amount of particles per bucket. Bucket ids are node ids,
+// nodes are never merged back so ids handed out stay valid: after a split the id refers to an
+// inner node, whose area still covers every neighbor of the particles that were in it.
+class opp : public partition {
+public:
+    opp(float min_val, float max_val, float radius, uint32_t leaf_capacity = 32);
+    ~opp() = default;
+
+    cell_id add(const glm::vec3& pos, size_t external_idx) override;
+    void remove(cell_id bucket_id, size_t external_idx) override;
+    void visit_buckets_area(cell_id bucket_id, const bucket_visitor& visit) const override;
+    bucket_view get_bucket(cell_id bucket_id) const override;
+    size_t get_storage_index(cell_id bucket_id) const override { return static_cast<size_t>(bucket_id); }
+
+    std::vector<cell_id> rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) override;
+    bool should_rebuild(size_t changed_count) const override;
+    size_t size() const override { return m_storage.size(); }
+private:
+    static constexpr uint32_t k_no_children = 0;
+    static constexpr uint32_t k_max_depth = 20;
+
+    struct node {
+        glm::vec3 min;
+        float size;
+        uint32_t depth;
+        uint32_t first_child = k_no_children; // Children are stored consecutively.
+    };
+
+    std::vector<node> m_nodes;
+    cell_storage m_storage; // One cell per node, only leaves hold particles.
+    std::vector<uint32_t> m_leaf_of; // Leaf of each external index.
+    std::vector<glm::vec3> m_positions; // Position of each external index, needed to split.
+    float m_radius;
+    uint32_t m_leaf_capacity;
+
+    void reset();
+    uint32_t find_leaf(const glm::vec3& pos) const;
+    uint32_t get_child(const node& n, const glm::vec3& pos) const;
+    bool can_split(uint32_t node_idx) const;
+    void create_children(uint32_t node_idx);
+    void split(uint32_t node_idx);
+    void build(uint32_t node_idx, size_t* first, size_t* last, const std::vector<glm::vec3>& positions, std::vector<cell_id>& leaves);
+    void track(size_t external_idx, uint32_t leaf, const glm::vec3& pos);
+};
+
+#endif // _OPP_H_
@@ -0,0 +1,526 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "particle_engine.h"
+#include "density_kernel.h"
+#include "opp.h"
+#include "spp.h"
+#include "sspp.h"
+#include <simple-assert.h>
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+static const auto k_max_coord_value = 1.f;
+static const auto k_min_coord_value = -1.f;
+static const auto k_particle_threshold2 = 0.004f;
+static const uint32_t k_interval_count = static_cast<uint32_t>(std::floor((k_max_coord_value - k_min_coord_value) / std::sqrt(k_particle_threshold2)));
+static const size_t k_chunks_per_thread = 8;
+static const size_t k_min_chunk_size = 16;
+static const size_t k_gather_block_size = 64;
+static const size_t k_spawn_batch_size = 1000;
+static_assert(k_gather_block_size <= density_kernel::k_max_mask_count, "A gathered block is tested with a single mask");
+static const uint32_t k_default_sort_interval = 0;
+static const size_t k_dead_sort_key = ~size_t{ 0 };
+static const float k_death_tick_length = 100.f;
+static const float k_clock_rebase = 1000.f * 1000.f;
+
+// Longest life for count particles. The spawn cycle comes back to batch k once every num_batches
+// updates and its lives are meant to last num_batches / (k + 1) times k_total_life. The mean of
+// that over every slot keeps births and deaths at the pace the cycle expects.
+static float get_total_life(const size_t count) {
+    const size_t num_batches = (count / k_spawn_batch_size) + 1;
+    double scale = 0.;
+    for (size_t batch = 0; batch < num_batches; batch++) {
+        const auto first = std::min(count, batch * k_spawn_batch_size);
+        const auto last = std::min(count, first + k_spawn_batch_size);
+        scale += static_cast<double>(last - first) * num_batches / (batch + 1);
+    }
+    return particle_data::k_total_life * static_cast<float>(scale / std::max<size_t>(1, count));
+}
+
+particle_engine::particle_engine(const uint32_t max_number, const particle_layout_type lt, const bool stop_after_load, const partition_type pt)
+    : m_dis01(0.f, 1.f)
+    , m_dis11(-1.f, 1.f)
+    , m_lt(lt)
+    , m_pt(pt)
+    , m_particles(max_number)
+    , m_particles_data(max_number)
+    , m_touched_epoch(max_number, 0)
+    , m_live_slot(max_number)
+    , m_total_life(get_total_life(max_number))
+    , m_deaths(k_death_tick_length, m_total_life)
+    , m_sort_interval(k_default_sort_interval)
+    , m_stop_after_load(stop_after_load) {
+    reset_optimizer();
+    rebuild_live_lists();
+}
+
+void particle_engine::set_particle_layout(const particle_layout_type lt) {
+    m_lt = lt;
+    init_particles();
+}
+
+template <typename F>
+void particle_engine::visit_close(const partition::bucket_view& bucket, const size_t first, const glm::vec3& pos, const F& visit) const {
+    // A block at a time through the vector kernel, only the hits are visited.
+    alignas(32) float x[k_gather_block_size], y[k_gather_block_size], z[k_gather_block_size];
+    for (auto block = first; block < bucket.size(); block += k_gather_block_size) {
+        const auto block_count = std::min(k_gather_block_size, bucket.size() - block);
+        uint64_t mask;
+        if (bucket.x) {
+            mask = density_kernel::mask_within(bucket.x + block, bucket.y + block, bucket.z + block, block_count, pos, k_particle_threshold2);
+        } else {
+            for (size_t bix = 0; bix < block_count; bix++) {
+                const auto ix = bucket.first[block + bix];
+                x[bix] = m_particles.x[ix];
+                y[bix] = m_particles.y[ix];
+                z[bix] = m_particles.z[ix];
+            }
+            mask = density_kernel::mask_within(x, y, z, block_count, pos, k_particle_threshold2);
+        }
+        for (; mask != 0; mask &= mask - 1) {
+            visit(block + density_kernel::lowest_bit(mask));
+        }
+    }
+}
+
+template <typename F>
+void particle_engine::visit_neighbors(const size_t ix, const F& visit) const {
+    const auto pos = m_particles.get_position(ix);
+    m_optimizer->visit_buckets_area(m_particles_data[ix].bucket, [this, ix, &pos, &visit](const partition::cell_id bucket_id) {
+        const auto others = m_optimizer->get_bucket(bucket_id);
+        visit_close(others, 0, pos, [ix, &others, &visit](const size_t k) {
+            const auto jx = others.first[k];
+            if (jx != ix) {
+                visit(jx);
+            }
+        });
+    });
+}
+
+bool particle_engine::update(const float dt) {
+    if (!m_update_particles) {
+        return false;
+    }
+    const size_t total_size = m_particles_data.size();
+    const size_t num_batches = (total_size / k_spawn_batch_size) + 1;
+
+    const size_t batch = std::min(m_updated_batch, num_batches - 1);
+    m_updated_batch = (batch + 1) % num_batches;
+    if (m_stop_after_load && m_updated_batch == 0) {
+        m_update_particles = false;
+    }
+
+    // Nothing ages, only the particles whose death time is reached are visited.
+    m_clock += dt;
+    m_born.clear();
+    m_died.clear();
+    begin_touched();
+    m_all_changed = false;
+    m_deaths.advance(m_clock, m_died);
+    for (auto ix : m_died) {
+        m_particles.death_time[ix] = 0.f;
+        touch(ix);
+    }
+    if (m_clock > k_clock_rebase) {
+        // Far from the origin float times lose precision, pull everything back.
+        const auto offset = m_deaths.rebase(m_clock);
+        m_clock -= offset;
+        for (auto ix : m_live) {
+            if (m_particles.alive(ix)) {
+                m_particles.death_time[ix] -= offset;
+            }
+        }
+        m_all_changed = true;
+    }
+
+    // The batches left in the cycle share the free slots, so every one of them gets a 90%
+    // chance to respawn once per cycle.
+    const size_t batches_left = num_batches - batch;
+    const size_t spawn_candidates = (m_free.size() + batches_left - 1) / batches_left;
+    const auto spawn_count = std::binomial_distribution<size_t>{ spawn_candidates, .9 }(m_generator);
+    for (size_t bix = 0; bix < spawn_count; bix++) {
+        // Just born.
+        const auto ix = m_free.back();
+        m_free.pop_back();
+        gen_particle_position(ix);
+        // Never born dead: 1 - dis01 is in (0, 1].
+        m_particles.death_time[ix] = m_clock + m_total_life * (1.f - m_dis01(m_generator));
+        m_deaths.add(static_cast<uint32_t>(ix), m_particles.death_time[ix]);
+        m_particles.density[ix] = 0;
+        add_live(ix);
+        m_born.push_back(ix);
+        touch(ix);
+    }
+    for (auto ix : m_died) {
+        remove_live(ix);
+        m_free.push_back(static_cast<uint32_t>(ix));
+    }
+
+    const bool track_density = m_lt != particle_layout_type::DEMO_DUAL_COLOR_SLICE;
+    if (m_optimizer->should_rebuild(m_born.size() + m_died.size())) {
+        // Most particles changed, recount everything from scratch.
+        rebuild_optimizer();
+        if (track_density) {
+            recompute_density();
+            m_all_changed = true;
+        }
+    } else {
+        // Densities are kept exact: every close pair adds one to both particles when the second
+        // one is born, and takes it back when the first one dies.
+        for (auto ix : m_died) {
+            m_optimizer->remove(m_particles_data[ix].bucket, ix);
+            auto& density = m_particles.density[ix];
+            if (track_density) {
+                visit_neighbors(ix, [this](const size_t jx) {
+                    set_density(jx, m_particles.density[jx] - 1);
+                });
+                remove_from_histogram(density);
+            }
+            density = 0;
+        }
+        for (auto ix : m_born) {
+            m_particles_data[ix].bucket = m_optimizer->add(m_particles.get_position(ix), ix);
+            if (track_density) {
+                add_to_histogram(0);
+                visit_neighbors(ix, [this, ix](const size_t jx) {
+                    set_density(ix, m_particles.density[ix] + 1);
+                    set_density(jx, m_particles.density[jx] + 1);
+                });
+            }
+        }
+    }
+
+    if (m_sort_interval > 0 && ++m_frames_since_sort >= m_sort_interval) {
+        sort_particles();
+    }
+    return true;
+}
+
+void particle_engine::init_particles() {
+    reset_optimizer();
+
+    std::fill(m_particles.death_time.begin(), m_particles.death_time.end(), 0.f);
+    m_deaths.clear();
+    std::fill(m_particles.density.begin(), m_particles.density.end(), 0);
+    m_all_changed = true;
+    m_updated_batch = 0;
+    rebuild_live_lists();
+    rebuild_density_histogram();
+    m_update_particles = true;
+}
+
+void particle_engine::reset_optimizer() {
+    if (m_pt == partition_type::OCTREE) {
+        m_optimizer.reset(new opp{ k_min_coord_value, k_max_coord_value, std::sqrt(k_particle_threshold2) });
+        return;
+    }
+    switch (m_lt) {
+        case particle_layout_type::RANDOM_CARTESIAN_NAIVE:
+        case particle_layout_type::RANDOM_CARTESIAN_DISCARD:
+        case particle_layout_type::RANDOM_SPHERICAL_NAIVE:
+        case particle_layout_type::RANDOM_SPHERICAL_LATITUDE: {
+            // All of these end up on the unit sphere surface.
+            m_optimizer.reset(new sspp{ std::sqrt(k_particle_threshold2) });
+        } break;
+        case particle_layout_type::RANDOM_CARTESIAN_CUBE:
+        case particle_layout_type::DEMO_DUAL_COLOR_SLICE: {
+            m_optimizer.reset(new spp{ k_interval_count, k_min_coord_value, k_max_coord_value, spp::cell_order::MORTON, spp::cell_content::POSITIONS });
+        } break;
+    }
+}
+
+void particle_engine::rebuild_optimizer() {
+    std::vector<glm::vec3> positions;
+    std::vector<size_t> indices;
+    positions.reserve(m_live.size());
+    indices.reserve(m_live.size());
+    for (auto ix : m_live) {
+        positions.push_back(m_particles.get_position(ix));
+        indices.push_back(ix);
+    }
+
+    const auto buckets = m_optimizer->rebuild(positions, indices);
+    for (size_t ix = 0; ix < indices.size(); ix++) {
+        m_particles_data[indices[ix]].bucket = buckets[ix];
+    }
+}
+
+template <typename T>
+static void apply_order(std::vector<T>& values, const std::vector<size_t>& order) {
+    std::vector<T> sorted(values.size());
+    for (size_t ix = 0; ix < order.size(); ix++) {
+        sorted[ix] = values[order[ix]];
+    }
+    values.swap(sorted);
+}
+
+void particle_engine::sort_particles() {
+    // Particles follow their buckets in the partition's storage order, so they sit in memory in the
+    // same order as the cells. Dead ones go last. Every slot changes, readers are told through
+    // all_changed.
+    m_sort_order.resize(m_particles_data.size());
+    m_new_slots.resize(m_particles_data.size());
+    m_sort_keys.resize(m_particles_data.size());
+    std::iota(m_sort_order.begin(), m_sort_order.end(), 0);
+    for (size_t ix = 0; ix < m_sort_keys.size(); ix++) {
+        m_sort_keys[ix] = m_particles.alive(ix) ? m_optimizer->get_storage_index(m_particles_data[ix].bucket) : k_dead_sort_key;
+    }
+    std::sort(m_sort_order.begin(), m_sort_order.end(), [this](const size_t lhs, const size_t rhs) {
+        return (m_sort_keys[lhs] != m_sort_keys[rhs]) ? m_sort_keys[lhs] < m_sort_keys[rhs] : lhs < rhs;
+    });
+
+    apply_order(m_particles.x, m_sort_order);
+    apply_order(m_particles.y, m_sort_order);
+    apply_order(m_particles.z, m_sort_order);
+    apply_order(m_particles.density, m_sort_order);
+    apply_order(m_particles.death_time, m_sort_order);
+    apply_order(m_particles_data, m_sort_order);
+    // The death queue goes from old slots to new ones.
+    for (size_t ix = 0; ix < m_sort_order.size(); ix++) {
+        m_new_slots[m_sort_order[ix]] = ix;
+    }
+    m_deaths.remap(m_new_slots);
+    for (auto& pd : m_particles_data) {
+        pd.bucket = partition::k_invalid_cell;
+    }
+    // Live particles are now the first slots. The partition holds the old slots, load it again with
+    // the new ones.
+    rebuild_live_lists();
+    rebuild_optimizer();
+    m_all_changed = true;
+    m_frames_since_sort = 0;
+}
+
+void particle_engine::gen_particle_position(const size_t index) {
+    using namespace util::coords;
+    using namespace util::math;
+    glm::vec3 candidate;
+    bool normalize = true;
+    switch (m_lt) {
+        case particle_layout_type::RANDOM_CARTESIAN_DISCARD: {
+            do {
+                candidate = glm::vec3(m_dis11(m_generator), m_dis11(m_generator), m_dis11(m_generator));
+            } while (glm::length2(candidate) > 1.f);
+        } break;
+        case particle_layout_type::RANDOM_SPHERICAL_NAIVE: {
+            candidate = get_unit_cartesian(glm::vec2{ m_dis01(m_generator) * twoPi, m_dis01(m_generator) * pi });
+        } break;
+        case particle_layout_type::RANDOM_SPHERICAL_LATITUDE: {
+            candidate = get_unit_cartesian(m_dis01(m_generator), m_dis01(m_generator));
+        } break;
+        case particle_layout_type::DEMO_DUAL_COLOR_SLICE : {
+            normalize = false;
+            candidate = glm::vec3(m_dis11(m_generator), m_dis11(m_generator), 0);
+        } break;
+        case particle_layout_type::RANDOM_CARTESIAN_CUBE: {
+            normalize = false;
+        } // Note no break.
+        case particle_layout_type::RANDOM_CARTESIAN_NAIVE: {
+            candidate = glm::vec3(m_dis11(m_generator), m_dis11(m_generator), m_dis11(m_generator));
+        } break;
+    }
+    m_particles.set_position(index, (normalize) ? glm::normalize(candidate) : candidate);
+}
+
+void particle_engine::recompute_density() {
+    std::fill(m_particles.density.begin(), m_particles.density.end(), 0);
+
+    const auto grid = dynamic_cast<const spp*>(m_optimizer.get());
+    if (!grid) {
+        // No half stencil on the other partitions, count every pair from both sides.
+        update_colors_optimizer(m_live);
+        return;
+    }
+
+    // Every bucket against its half stencil, counting each close pair once for both particles.
+    const auto count_layer = [this, grid](const uint32_t x) {
+        spp::bucket_area forward;
+        grid->visit_layer(x, [this, grid, &forward](const partition::cell_id bucket_id) {
+            const auto own = grid->get_bucket(bucket_id);
+            grid->get_forward_buckets_area(bucket_id, forward);
+            for (auto other_id : forward) {
+                const auto others = grid->get_bucket(other_id);
+                for (size_t k = 0; k < own.size(); k++) {
+                    const auto left_pos = m_particles.get_position(own.first[k]);
+                    auto& left_density = m_particles.density[own.first[k]];
+                    // Within the own bucket only the pairs after k. The hit mask tells which of the
+                    // others get the pair too.
+                    const size_t first = (other_id == bucket_id) ? k + 1 : 0;
+                    visit_close(others, first, left_pos, [this, &others, &left_density](const size_t hit) {
+                        left_density++;
+                        m_particles.density[others.first[hit]]++;
+                    });
+                }
+            }
+        });
+    };
+
+    // A layer only writes to itself and the next one, so all even layers can run at the same time,
+    // and then all odd ones.
+    const auto layers = grid->get_intervals_per_axis();
+    for (uint32_t parity = 0; parity < 2; parity++) {
+        m_pool.parallel_for((layers - parity + 1) / 2, 1, [&count_layer, parity](const size_t begin, const size_t end) {
+            for (auto lx = begin; lx < end; lx++) {
+                count_layer(static_cast<uint32_t>(parity + 2 * lx));
+            }
+        });
+    }
+    rebuild_density_histogram();
+}
+
+void particle_engine::rebuild_density_histogram() {
+    m_density_histogram.clear();
+    m_max_density = 0;
+    for (auto ix : m_live) {
+        add_to_histogram(m_particles.density[ix]);
+    }
+}
+
+void particle_engine::add_to_histogram(const uint32_t density) {
+    if (density >= m_density_histogram.size()) {
+        m_density_histogram.resize(density + 1);
+    }
+    m_density_histogram[density]++;
+    m_max_density = std::max(m_max_density, density);
+}
+
+void particle_engine::remove_from_histogram(const uint32_t density) {
+    SPL_ASSERT(density < m_density_histogram.size() && m_density_histogram[density] > 0, "The density was not counted");
+    m_density_histogram[density]--;
+    // Only moves down while the top values empty, each step was climbed by an earlier add.
+    while (m_max_density > 0 && m_density_histogram[m_max_density] == 0) {
+        m_max_density--;
+    }
+}
+
+void particle_engine::set_density(const size_t ix, const uint32_t density) {
+    remove_from_histogram(m_particles.density[ix]);
+    add_to_histogram(density);
+    m_particles.density[ix] = density;
+    touch(ix);
+}
+
+uint32_t particle_engine::count_close(const partition::bucket_view& bucket, const glm::vec3& pos) const {
+    if (bucket.x) {
+        return density_kernel::count_within(bucket.x, bucket.y, bucket.z, bucket.size(), pos, k_particle_threshold2);
+    }
+
+    // Coordinates gathered in contiguous blocks for the vector kernel.
+    alignas(32) float x[k_gather_block_size], y[k_gather_block_size], z[k_gather_block_size];
+    uint32_t result = 0;
+    for (auto block_it = bucket.begin(); block_it != bucket.end();) {
+        const auto block_count = std::min<size_t>(k_gather_block_size, bucket.end() - block_it);
+        for (size_t bix = 0; bix < block_count; bix++, block_it++) {
+            x[bix] = m_particles.x[*block_it];
+            y[bix] = m_particles.y[*block_it];
+            z[bix] = m_particles.z[*block_it];
+        }
+        result += density_kernel::count_within(x, y, z, block_count, pos, k_particle_threshold2);
+    }
+    return result;
+}
+
+void particle_engine::rebuild_live_lists() {
+    m_live.clear();
+    m_free.clear();
+    for (size_t ix = 0; ix < m_particles.size(); ix++) {
+        if (m_particles.alive(ix)) {
+            add_live(ix);
+        }
+    }
+    // Backwards, so that the lowest slots are spawned first.
+    for (auto ix = m_particles.size(); ix-- > 0;) {
+        if (!m_particles.alive(ix)) {
+            m_free.push_back(static_cast<uint32_t>(ix));
+        }
+    }
+}
+
+void particle_engine::add_live(const size_t ix) {
+    m_live_slot[ix] = static_cast<uint32_t>(m_live.size());
+    m_live.push_back(static_cast<uint32_t>(ix));
+}
+
+void particle_engine::remove_live(const size_t ix) {
+    // Swap with the last one, the order of the live list is irrelevant.
+    const auto slot = m_live_slot[ix];
+    const auto moved = m_live.back();
+    m_live[slot] = moved;
+    m_live_slot[moved] = slot;
+    m_live.pop_back();
+}
+
+void particle_engine::begin_touched() {
+    m_touched.clear();
+    if (++m_epoch == 0) {
+        // Wrapped around, old stamps could match again.
+        std::fill(m_touched_epoch.begin(), m_touched_epoch.end(), 0);
+        m_epoch = 1;
+    }
+}
+
+void particle_engine::touch(const size_t ix) {
+    if (m_touched_epoch[ix] != m_epoch) {
+        m_touched_epoch[ix] = m_epoch;
+        m_touched.push_back(ix);
+    }
+}
+
+void particle_engine::update_colors_optimizer(const std::vector<uint32_t>& updated_indices) {
+    const auto update_range_counts = [this, &updated_indices](const size_t range_begin, const size_t range_end) {
+        for (auto uix = range_begin; uix < range_end; uix++) {
+            const auto ix = updated_indices[uix];
+            if (m_particles.alive(ix)) {
+                const auto pos = m_particles.get_position(ix);
+                uint32_t close_count = 0;
+                m_optimizer->visit_buckets_area(m_particles_data[ix].bucket, [this, &pos, &close_count](const partition::cell_id bucket_id) {
+                    close_count += count_close(m_optimizer->get_bucket(bucket_id), pos);
+                });
+                // Minus the particle itself, always in its own bucket.
+                m_particles.density[ix] += close_count - 1;
+            }
+        }
+    };
+
+    // The cost of a particle is about the amount of candidates around it, which varies wildly with
+    // the local density. Cut in chunks of similar cost, idle threads steal the ones left.
+    m_density_costs.resize(updated_indices.size());
+    for (size_t uix = 0; uix < updated_indices.size(); uix++) {
+        const auto ix = updated_indices[uix];
+        uint32_t cost = 1;
+        if (m_particles.alive(ix)) {
+            m_optimizer->visit_buckets_area(m_particles_data[ix].bucket, [this, &cost](const partition::cell_id bucket_id) {
+                cost += static_cast<uint32_t>(m_optimizer->get_bucket(bucket_id).size());
+            });
+        }
+        m_density_costs[uix] = cost;
+    }
+    const size_t thread_count = m_pool.get_worker_count() + 1;
+    const auto chunk_count = std::max<size_t>(1, std::min(k_chunks_per_thread * thread_count, updated_indices.size() / k_min_chunk_size));
+    thread_pool::split_by_cost(m_density_costs, chunk_count, m_density_chunks);
+    m_pool.parallel_for(m_density_chunks, update_range_counts);
+
+    rebuild_density_histogram();
+}
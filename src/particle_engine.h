@@ -0,0 +1,214 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _PARTICLE_ENGINE_H_
+#define _PARTICLE_ENGINE_H_
+#include "particle_store.h"
+#include "partition.h"
+#include "thread_pool.h"
+#include "timing_wheel.h"
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+namespace util {
+    namespace math {
+        constexpr double pi = 3.141592653589793238462643383279502884;
+        constexpr double twoPi = 2. * pi;
+    }
+    namespace coords {
+        inline glm::vec2 get_unit_sphere(const glm::vec3& cartesian) {
+            return glm::vec2{
+                std::atan2(cartesian.y, cartesian.x), //theta = x
+                std::acos(cartesian.z) //phi = y
+            };
+        }
+
+        inline glm::vec3 get_unit_cartesian(const glm::vec2& sphere) {
+            auto sy = std::sin(sphere.y);
+            return glm::vec3{
+                std::cos(sphere.x) * sy,
+                std::sin(sphere.x) * sy,
+                std::cos(sphere.y)
+            };
+        }
+
+        inline glm::vec3 get_unit_cartesian(const float e0, const float e1) {
+            const auto z = 1.f - 2.f * e0;
+            const auto r = std::sqrt(1.f - z * z);
+            const auto theta = 2.f * util::math::pi * e1;
+            return glm::vec3{
+                r * std::cos(theta),
+                r * std::sin(theta),
+                z
+            };
+        }
+    }
+}
+
+struct particle_data {
+    constexpr static float k_total_life = 10.f * 1000.f;
+    // The neighbour buckets are asked to the partition when needed, nothing here owns memory.
+    partition::cell_id bucket = partition::k_invalid_cell;
+};
+static_assert(std::is_trivially_copyable<particle_data>::value, "particle_data is copied in bulk");
+
+enum class particle_layout_type : short {
+    RANDOM_CARTESIAN_NAIVE,
+    RANDOM_CARTESIAN_DISCARD,
+    RANDOM_SPHERICAL_NAIVE,
+    RANDOM_SPHERICAL_LATITUDE,
+    RANDOM_CARTESIAN_CUBE,
+    DEMO_DUAL_COLOR_SLICE
+};
+
+enum class partition_type : short {
+    GRID, // Uniform grid, on the sphere surface for the layouts that live there.
+    OCTREE // Adaptive octree, for highly clustered layouts.
+};
+
+// The particle simulation on its own: lifecycle, partition and densities, nothing about drawing.
+// After every update the particles, the live list and what changed are there to be read.
+class particle_engine {
+public:
+    particle_engine(
+        uint32_t max_number = 20000,
+        particle_layout_type lt = particle_layout_type::RANDOM_CARTESIAN_CUBE,
+        bool stop_after_load = false,
+        partition_type pt = partition_type::GRID);
+
+    // Kills every particle, they spawn again with the new layout.
+    void set_particle_layout(particle_layout_type lt);
+    // Returns false when paused, nothing changed then.
+    bool update(float dt);
+
+    void toggle_update_particles() {
+        m_update_particles = !m_update_particles;
+    }
+
+    // Every how many updates the particles are reordered by bucket, 0 (the default) disables it.
+    void set_sort_interval(const uint32_t frames) {
+        m_sort_interval = frames;
+    }
+
+    particle_layout_type get_layout() const {
+        return m_lt;
+    }
+
+    const particle_store& get_particles() const {
+        return m_particles;
+    }
+
+    // Live slots in no particular order.
+    const std::vector<uint32_t>& get_live() const {
+        return m_live;
+    }
+
+    // Slots whose density or life changed in the last update, each one listed once.
+    const std::vector<size_t>& get_touched() const {
+        return m_touched;
+    }
+
+    // Set when more changed than the touched list tells: every slot has to be read again.
+    bool all_changed() const {
+        return m_all_changed;
+    }
+
+    uint32_t get_max_density() const {
+        return m_max_density;
+    }
+
+    // Death times are given in this clock.
+    float get_clock() const {
+        return m_clock;
+    }
+
+private:
+    std::mt19937 m_generator{ std::random_device{}() };
+    std::uniform_real_distribution<float> m_dis01, m_dis11;
+    particle_layout_type m_lt;
+    partition_type m_pt;
+    particle_store m_particles;
+    std::vector<particle_data> m_particles_data;
+    std::shared_ptr<partition> m_optimizer;
+    thread_pool m_pool;
+    std::vector<uint32_t> m_density_costs;
+    std::vector<size_t> m_density_chunks;
+    // Per frame lists, cleared instead of reallocated.
+    std::vector<size_t> m_born, m_died;
+    // Particles whose density or life changed this frame, each one listed once: it is already in the
+    // list when its stamp matches the current epoch.
+    std::vector<size_t> m_touched;
+    std::vector<uint32_t> m_touched_epoch;
+    uint32_t m_epoch = 0;
+    // Live slots in no particular order and the dead ones to spawn from.
+    std::vector<uint32_t> m_live, m_free;
+    std::vector<uint32_t> m_live_slot; // Position of every live particle in m_live.
+    float m_total_life; // Longest life, scaled with the spawn cycle.
+    timing_wheel m_deaths; // Live particles by death time.
+    float m_clock = 0.f;
+    std::vector<size_t> m_sort_order, m_new_slots, m_sort_keys;
+    uint32_t m_sort_interval;
+    uint32_t m_frames_since_sort = 0;
+    size_t m_updated_batch = 0; // Batch of the spawn cycle the next update is.
+    bool m_all_changed = true;
+    bool m_update_particles = true;
+    bool m_stop_after_load;
+    uint32_t m_max_density = 1;
+    std::vector<uint32_t> m_density_histogram; // Live particles with each density value.
+
+    void init_particles();
+    void reset_optimizer();
+    void rebuild_optimizer();
+    // Calls visit(k) for every k-th particle of bucket, from first on, closer than the threshold to
+    // pos. Coordinates come from the bucket's own copy when it keeps one.
+    template <typename F>
+    void visit_close(const partition::bucket_view& bucket, size_t first, const glm::vec3& pos, const F& visit) const;
+    // Calls visit with every particle in the optimizer closer than the threshold to particle ix.
+    template <typename F>
+    void visit_neighbors(size_t ix, const F& visit) const;
+    // Reorders every particle array by bucket so that close particles are close in memory.
+    void sort_particles();
+    void gen_particle_position(size_t index);
+    void rebuild_live_lists();
+    void add_live(size_t ix);
+    void remove_live(size_t ix);
+    void update_colors_optimizer(const std::vector<uint32_t>& updated_indices);
+    // Particles of bucket closer than the threshold to pos.
+    uint32_t count_close(const partition::bucket_view& bucket, const glm::vec3& pos) const;
+    void recompute_density();
+    // The histogram of live densities gives the maximum, kept in step with every single change.
+    void rebuild_density_histogram();
+    void add_to_histogram(uint32_t density);
+    void remove_from_histogram(uint32_t density);
+    void set_density(size_t ix, uint32_t density);
+    void begin_touched();
+    void touch(size_t ix);
+};
+
+#endif // _PARTICLE_ENGINE_H_
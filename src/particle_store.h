@@ -0,0 +1,68 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _PARTICLE_STORE_H_
+#define _PARTICLE_STORE_H_
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Particle state as a structure of arrays: every loop only streams the fields it reads.
+struct particle_store {
+    std::vector<float> x, y, z;
+    std::vector<uint32_t> density;
+    // Simulation time the particle dies at, cleared to 0 once it does.
+    std::vector<float> death_time;
+
+    explicit particle_store(const size_t count)
+        : x(count), y(count), z(count), density(count), death_time(count) {
+    }
+
+    size_t size() const {
+        return x.size();
+    }
+
+    bool alive(const size_t ix) const {
+        return death_time[ix] > 0.f;
+    }
+
+    glm::vec3 get_position(const size_t ix) const {
+        return glm::vec3{ x[ix], y[ix], z[ix] };
+    }
+
+    void set_position(const size_t ix, const glm::vec3& pos) {
+        x[ix] = pos.x;
+        y[ix] = pos.y;
+        z[ix] = pos.z;
+    }
+
+    float distance2(const size_t ix, const glm::vec3& pos) const {
+        const auto dx = x[ix] - pos.x;
+        const auto dy = y[ix] - pos.y;
+        const auto dz = z[ix] - pos.z;
+        return dx * dx + dy * dy + dz * dz;
+    }
+};
+
+#endif // _PARTICLE_STORE_H_
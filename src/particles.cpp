@@ -23,67 +23,62 @@ SOFTWARE.
 #include "particles.h"
 #include "glprogram.h"
 #include "glutils.h"
-#include "spp.h"
 #include <logger.h>
 #include <timer.h>
-#include <glm/vec4.hpp>
-#include <glm/gtc/type_ptr.hpp>
-#include <glm/gtx/norm.hpp>
-#include <glm/gtx/transform.hpp>
 #include <algorithm>
-#include <functional>
-#include <numeric>
-#include <random>
-#include <set>
-#include <thread>
-#include <unordered_map>
 
-static const auto k_max_coord_value = 1.f;
-static const auto k_min_coord_value = -1.f;
-static const auto k_particle_threshold2 = 0.004f;
-static const uint8_t k_interval_count = static_cast<uint8_t>(std::floor((k_max_coord_value - k_min_coord_value) / std::sqrt(k_particle_threshold2)));
+static const float k_default_max_dirty_fraction = .25f;
+static const size_t k_upload_merge_gap = 16;
+static const GLuint64 k_fence_wait_ns = 1000 * 1000;
 static const std::string k_md_loc = "Inv_Max_Density";
+static const std::string k_time_loc = "Time";
 static const std::string k_dualc_loc = "Dual_Color_Demo";
 
-particles::particles(std::shared_ptr<glprogram> active_program, const uint32_t max_number, const particle_layout_type lt, const bool stop_after_load)
-    : m_dis01(0.f, 1.f)
-    , m_dis11(-1.f, 1.f)
-    , m_lt(lt)
-    , m_particles_render_data(max_number)
-    , m_particles_data(max_number)
-    , m_stop_after_load(stop_after_load) {
-    m_optimizer.reset(new spp{ k_interval_count, k_min_coord_value, k_max_coord_value });
+particles::particles(std::shared_ptr<glprogram> active_program, const uint32_t max_number, const particle_layout_type lt, const bool stop_after_load, const partition_type pt)
+    : m_engine(max_number, lt, stop_after_load, pt)
+    , m_render_data(max_number)
+    , m_max_dirty_fraction(k_default_max_dirty_fraction) {
+    // Nothing was ever written to the buffers.
+    m_pending_full.fill(true);
     setup_gl(active_program);
 }
 
 particles::~particles() {
+    for (auto& fence : m_fences) {
+        if (fence) {
+            gl::DeleteSync(fence);
+        }
+    }
     gl::DeleteBuffers(1, &m_ebo);
-    gl::DeleteBuffers(1, &m_vbo);
+    gl::DeleteBuffers(k_vbo_count, m_vbos.data());
     gl::DeleteVertexArrays(1, &m_vao);
     CHECK_GL_ERRORS();
 }
 
 void particles::set_particle_layout(const particle_layout_type lt) {
-    if (lt != m_lt) {
-        m_lt = lt;
-        init_particles();
-
-        gl::BindVertexArray(m_vao);
-        gl::BufferData(gl::ARRAY_BUFFER, m_particles_render_data.size() * sizeof(particle_render_data), m_particles_render_data.data(), gl::DYNAMIC_DRAW);
-        gl::BindVertexArray(0);
-        CHECK_GL_ERRORS();
+    if (lt != m_engine.get_layout()) {
+        m_engine.set_particle_layout(lt);
+        upload_render_data();
     }
 }
 
 void particles::render(std::shared_ptr<glprogram> active_program) {
     gl::BindVertexArray(m_vao);
 
-    gl::Uniform1f(active_program->get_uniform_location(k_md_loc), 1.f / std::max(1u, m_max_density));
-    gl::Uniform1ui(active_program->get_uniform_location(k_dualc_loc), (m_lt == particle_layout_type::DEMO_DUAL_COLOR_SLICE));
+    gl::Uniform1f(active_program->get_uniform_location(k_md_loc), 1.f / std::max(1u, m_engine.get_max_density()));
+    gl::Uniform1f(active_program->get_uniform_location(k_time_loc), m_engine.get_clock());
+    gl::Uniform1ui(active_program->get_uniform_location(k_dualc_loc), (m_engine.get_layout() == particle_layout_type::DEMO_DUAL_COLOR_SLICE));
     CHECK_GL_ERRORS();
-    const GLsizei count = m_particles_render_data.size();
+    const GLsizei count = m_engine.get_live().size();
     gl::DrawElements(gl::POINTS, count, gl::UNSIGNED_INT, 0);
     CHECK_GL_ERRORS();
+    // Signaled once the GPU is done reading the buffer, before it is written again.
+    auto& fence = m_fences[m_vbo_index];
+    if (fence) {
+        gl::DeleteSync(fence);
+    }
+    fence = gl::FenceSync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
+    CHECK_GL_ERRORS();
     gl::BindVertexArray(0);
     CHECK_GL_ERRORS();
 }
@@ -100,196 +95,114 @@ void particles::update(const float dt) {
         t.reset();
     }
 #endif
-    static size_t updated_batch = 0;
-    static const size_t batch_size = 1000;
-    if (m_update_particles) {
-        const size_t total_size = m_particles_data.size();
-        const size_t num_batches = (total_size / batch_size) + 1;
-
-        const size_t begin = batch_size * updated_batch;
-        const size_t end = std::min(begin + batch_size, total_size);
-        const float batch_dt = dt * (updated_batch + 1);
-        updated_batch = (updated_batch + 1) % num_batches;
-        if (m_stop_after_load && updated_batch == 0) {
-            m_update_particles = false;
-        }
-
-        std::set<size_t> updated;
-        for (auto ix = begin; ix < end; ix++) {
-            auto& rd = m_particles_render_data[ix];
-            auto& d = m_particles_data[ix];
-            if (rd.alive()) {
-                rd.time_to_death -= batch_dt;
-                if (!rd.alive()) {
-                    // Just died.
-                    m_optimizer->remove(d.bucket, ix);
-                    rd.density = 0;
-                    rd.time_to_death = 0.f;
-                    updated.insert(ix);
-                }
-            } else if (m_dis01(m_generator) < .9) {
-                // Just born.
-                updated.insert(ix);
-                gen_particle_position(ix);
-                rd.time_to_death = particle_data::k_total_life * m_dis01(m_generator);
-                rd.density = 0;
-                d.bucket = m_optimizer->add(m_particles_render_data[ix].pos, ix);
-            }
-        }
-
-        if (m_lt != particle_layout_type::DEMO_DUAL_COLOR_SLICE) {
-            std::set<size_t> all_updated;
-            for (auto ix : updated) {
-                all_updated.insert(ix);
-                auto& prd_ix = m_particles_render_data[ix];
-                auto& pd_ix = m_particles_data[ix];
-                pd_ix.affected_area = m_optimizer->get_buckets_area(pd_ix.bucket);
-
-                for (auto bucket_id : pd_ix.affected_area) {
-                    const auto& particles = m_optimizer->get_bucket(bucket_id);
-                    for (auto n : particles) {
-                        if (all_updated.find(n) != all_updated.end()) { continue; }
-                        auto& prd_n = m_particles_render_data[n];
-                        auto& pd_n = m_particles_data[n];
-                        if (prd_n.alive()) {
-                            pd_n.affected_area = m_optimizer->get_buckets_area(pd_n.bucket);
-                            all_updated.insert(n);
-                        }
-                    }
-                }
-
-                if (!prd_ix.alive()) {
-                    pd_ix.affected_area = {};
-                }
-            }
-
-            update_colors_optimizer(std::vector<size_t>{ all_updated.begin(), all_updated.end() });
-        }
-
-        gl::BindVertexArray(m_vao);
-        gl::BufferData(gl::ARRAY_BUFFER, m_particles_render_data.size() * sizeof(particle_render_data), m_particles_render_data.data(), gl::DYNAMIC_DRAW);
-        gl::BindVertexArray(0);
-        CHECK_GL_ERRORS();
-    }
-}
-
-void particles::init_particles() {
-    m_optimizer.reset(new spp{ k_interval_count, k_min_coord_value, k_max_coord_value });
-
-    for (auto& rd : m_particles_render_data) {
-        rd.time_to_death = 0;
-        rd.density = 0;
-    }
-    std::vector<size_t> all(m_particles_data.size());
-    std::iota(all.begin(), all.end(), 0);
-    update_colors_optimizer(all);
-    m_update_particles = true;
-}
-
-void particles::gen_particle_position(const size_t index) {
-    using namespace util::coords;
-    using namespace util::math;
-    glm::vec3 candidate;
-    bool normalize = true;
-    switch (m_lt) {
-        case particle_layout_type::RANDOM_CARTESIAN_DISCARD: {
-            do {
-                candidate = glm::vec3(m_dis11(m_generator), m_dis11(m_generator), m_dis11(m_generator));
-            } while (glm::length2(candidate) > 1.f);
-        } break;
-        case particle_layout_type::RANDOM_SPHERICAL_NAIVE: {
-            candidate = get_unit_cartesian(glm::vec2{ m_dis01(m_generator) * twoPi, m_dis01(m_generator) * pi });
-        } break;
-        case particle_layout_type::RANDOM_SPHERICAL_LATITUDE: {
-            candidate = get_unit_cartesian(m_dis01(m_generator), m_dis01(m_generator));
-        } break;
-        case particle_layout_type::DEMO_DUAL_COLOR_SLICE : {
-            normalize = false;
-            candidate = glm::vec3(m_dis11(m_generator), m_dis11(m_generator), 0);
-        } break;
-        case particle_layout_type::RANDOM_CARTESIAN_CUBE: {
-            normalize = false;
-        } // Note no break.
-        case particle_layout_type::RANDOM_CARTESIAN_NAIVE: {
-            candidate = glm::vec3(m_dis11(m_generator), m_dis11(m_generator), m_dis11(m_generator));
-        } break;
+    if (m_engine.update(dt)) {
+        upload_render_data();
     }
-    m_particles_render_data[index].pos = (normalize) ? glm::normalize(candidate) : candidate;
 }
 
 void particles::setup_gl(std::shared_ptr<glprogram> active_program) {
     gl::PointSize(2);
     gl::GenVertexArrays(1, &m_vao);
     gl::BindVertexArray(m_vao);
-    gl::GenBuffers(1, &m_vbo);
+    gl::GenBuffers(k_vbo_count, m_vbos.data());
     gl::GenBuffers(1, &m_ebo);
     CHECK_GL_ERRORS();
 
-    gl::BindBuffer(gl::ARRAY_BUFFER, m_vbo);
-
-    const GLint posAttrib = active_program->get_attrib_location("Position");
-    gl::EnableVertexAttribArray(posAttrib);
-    gl::VertexAttribPointer(posAttrib, 3, gl::FLOAT, gl::FALSE_, sizeof(particle_render_data), nullptr);
-    CHECK_GL_ERRORS();
-
-    const GLint densAttrib = active_program->get_attrib_location("Density");
-    gl::EnableVertexAttribArray(densAttrib);
-    gl::VertexAttribPointer(densAttrib, 1, gl::UNSIGNED_INT, gl::FALSE_, sizeof(particle_render_data), (void*) sizeof(glm::vec3));
+    m_pos_attrib = active_program->get_attrib_location("Position");
+    gl::EnableVertexAttribArray(m_pos_attrib);
+    m_dens_attrib = active_program->get_attrib_location("Density");
+    gl::EnableVertexAttribArray(m_dens_attrib);
+    m_death_attrib = active_program->get_attrib_location("Death_Time");
+    gl::EnableVertexAttribArray(m_death_attrib);
     CHECK_GL_ERRORS();
+    bind_vertex_buffer(m_vbo_index);
 
-    const GLint liveAttrib = active_program->get_attrib_location("Time_To_Death");
-    gl::EnableVertexAttribArray(liveAttrib);
-    gl::VertexAttribPointer(liveAttrib, 1, gl::FLOAT, gl::FALSE_, sizeof(particle_render_data), (void*) (sizeof(glm::vec3) + sizeof(uint32_t)));
-    CHECK_GL_ERRORS();
-
-    std::vector<GLuint> elements(m_particles_render_data.size());
-    std::iota(std::begin(elements), std::end(elements), 0);
-
+    // Filled with the live particles on every upload.
     gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, m_ebo);
-    gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(GLuint), elements.data(), gl::STATIC_DRAW);
     gl::BindVertexArray(0);
     CHECK_GL_ERRORS();
 }
 
-void particles::update_colors_optimizer(const std::vector<size_t>& updated_indices) {
-    static const auto max_threads = std::thread::hardware_concurrency() >  1u ? std::thread::hardware_concurrency() - 1u : 1u;
-    const auto update_range_counts = [this, updated_indices](const uint32_t range_begin, const uint32_t range_end) {
-        for (auto uix = range_begin; uix < range_end; uix++) {
-            const auto ix = updated_indices[uix];
-            auto& left_rd = m_particles_render_data[ix];
-            if (left_rd.alive()) {
-                auto& area = m_particles_data[ix].affected_area;
-                for (auto bucket_id : area) {
-                    const auto& others = m_optimizer->get_bucket(bucket_id);
-                    for (auto jx : others) {
-                        if (jx != ix && m_particles_render_data[jx].alive()) {
-                            if (glm::distance2(left_rd.pos, m_particles_render_data[jx].pos) < k_particle_threshold2) {
-                                left_rd.density++;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    };
+void particles::pack_render_data(const size_t begin, const size_t end) {
+    // Interleaved only here, in the vertex layout the program expects.
+    const auto& store = m_engine.get_particles();
+    for (auto ix = begin; ix < end; ix++) {
+        auto& rd = m_render_data[ix];
+        rd.pos = store.get_position(ix);
+        rd.density = store.density[ix];
+        rd.death_time = store.death_time[ix];
+    }
+}
 
-    //TODO: Use a pool, we shouldn't be creating and killing threads each frame...
-    std::vector<std::thread> workers;
-    const size_t bucket_size = updated_indices.size() / max_threads;
-    for (auto ix = 0u; ix < max_threads; ix++) {
-        size_t rbegin = ix * bucket_size;
-        size_t rend = rbegin + bucket_size;
-        workers.push_back(std::thread(std::bind(update_range_counts, rbegin, rend)));
+void particles::bind_vertex_buffer(const size_t vbo_index) {
+    // The attribute pointers keep the buffer bound when they are set, point them at the new one.
+    gl::BindBuffer(gl::ARRAY_BUFFER, m_vbos[vbo_index]);
+    gl::VertexAttribPointer(m_pos_attrib, 3, gl::FLOAT, gl::FALSE_, sizeof(particle_render_data), nullptr);
+    gl::VertexAttribPointer(m_dens_attrib, 1, gl::UNSIGNED_INT, gl::FALSE_, sizeof(particle_render_data), (void*) sizeof(glm::vec3));
+    gl::VertexAttribPointer(m_death_attrib, 1, gl::FLOAT, gl::FALSE_, sizeof(particle_render_data), (void*) (sizeof(glm::vec3) + sizeof(uint32_t)));
+    CHECK_GL_ERRORS();
+}
+
+void particles::wait_vertex_buffer(const size_t vbo_index) {
+    auto& fence = m_fences[vbo_index];
+    if (!fence) {
+        return;
     }
+    // Only blocks when the GPU is still drawing the frame from k_vbo_count frames ago.
+    GLenum result;
+    do {
+        result = gl::ClientWaitSync(fence, gl::SYNC_FLUSH_COMMANDS_BIT, k_fence_wait_ns);
+    } while (result == gl::TIMEOUT_EXPIRED);
+    gl::DeleteSync(fence);
+    fence = nullptr;
+    CHECK_GL_ERRORS();
+}
 
-    for (auto& worker : workers) {
-        worker.join();
+void particles::upload_render_data() {
+    // This frame's changes are owed to every buffer of the ring, each one is brought up to date when
+    // its turn to be written comes.
+    const auto& touched = m_engine.get_touched();
+    for (size_t vix = 0; vix < k_vbo_count; vix++) {
+        if (m_engine.all_changed()) {
+            m_pending_full[vix] = true;
+        }
+        if (!m_pending_full[vix]) {
+            m_pending[vix].insert(m_pending[vix].end(), touched.begin(), touched.end());
+        }
     }
 
-    m_max_density = 0;
-    for (auto& rd : m_particles_render_data) {
-        if (rd.alive() && rd.density > m_max_density) {
-            m_max_density = rd.density;
+    // Write the buffer the GPU is least likely to be reading, the last one drawn is left alone.
+    m_vbo_index = (m_vbo_index + 1) % k_vbo_count;
+    wait_vertex_buffer(m_vbo_index);
+    gl::BindVertexArray(m_vao);
+    bind_vertex_buffer(m_vbo_index);
+
+    auto& pending = m_pending[m_vbo_index];
+    const auto dirty_limit = static_cast<size_t>(m_max_dirty_fraction * m_render_data.size());
+    if (m_pending_full[m_vbo_index] || pending.size() > dirty_limit) {
+        pack_render_data(0, m_render_data.size());
+        gl::BufferData(gl::ARRAY_BUFFER, m_render_data.size() * sizeof(particle_render_data), m_render_data.data(), gl::DYNAMIC_DRAW);
+    } else {
+        // Only what changed since this buffer was written, in ranges of slots. Close ranges are
+        // merged, sending a few unchanged particles is cheaper than another call.
+        std::sort(pending.begin(), pending.end());
+        for (size_t pix = 0; pix < pending.size();) {
+            const auto begin = pending[pix];
+            auto end = begin + 1;
+            for (pix++; pix < pending.size() && pending[pix] <= end + k_upload_merge_gap; pix++) {
+                end = std::max(end, pending[pix] + 1);
+            }
+            pack_render_data(begin, end);
+            gl::BufferSubData(gl::ARRAY_BUFFER, begin * sizeof(particle_render_data), (end - begin) * sizeof(particle_render_data), m_render_data.data() + begin);
         }
     }
+    pending.clear();
+    m_pending_full[m_vbo_index] = false;
+
+    // Only the live particles are drawn.
+    const auto& live = m_engine.get_live();
+    gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, live.size() * sizeof(uint32_t), live.data(), gl::DYNAMIC_DRAW);
+    gl::BindVertexArray(0);
+    CHECK_GL_ERRORS();
 }
+
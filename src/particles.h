@@ -20,80 +20,27 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+
 #ifndef _PARTICLES_H_
 #define _PARTICLES_H_
+#include "particle_engine.h"
 #include <gl_core_3_3_noext_pcpp.hpp>
-#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
-#include <cmath>
+#include <array>
 #include <cstdint>
 #include <memory>
-#include <random>
 #include <vector>
 
-namespace util {
-    namespace math {
-        constexpr double pi = 3.141592653589793238462643383279502884;
-        constexpr double twoPi = 2. * pi;
-    }
-    namespace coords {
-        inline glm::vec2 get_unit_sphere(const glm::vec3& cartesian) {
-            return glm::vec2{
-                std::atan2(cartesian.y, cartesian.x), //theta = x
-                std::acos(cartesian.z) //phi = y
-            };
-        }
-
-        inline glm::vec3 get_unit_cartesian(const glm::vec2& sphere) {
-            auto sy = std::sin(sphere.y);
-            return glm::vec3{
-                std::cos(sphere.x) * sy,
-                std::sin(sphere.x) * sy,
-                std::cos(sphere.y)
-            };
-        }
-
-        inline glm::vec3 get_unit_cartesian(const float e0, const float e1) {
-            const auto z = 1.f - 2.f * e0;
-            const auto r = std::sqrt(1.f - z * z);
-            const auto theta = 2.f * util::math::pi * e1;
-            return glm::vec3{
-                r * std::cos(theta),
-                r * std::sin(theta),
-                z
-            };
-        }
-    }
-}
-
 class glprogram;
-class spp;
 
+// Vertex layout of the particles buffer.
 struct particle_render_data {
     glm::vec3 pos;
     uint32_t density = 0;
-    float time_to_death = 0.f;
-
-    bool alive() const {
-        return time_to_death > 0.f;
-    }
-};
-
-struct particle_data {
-    constexpr static float k_total_life = 10.f * 1000.f;
-    uint32_t bucket = 0xFFFFFFFF;
-    std::vector<uint32_t> affected_area;
-};
-
-enum class particle_layout_type : short {
-    RANDOM_CARTESIAN_NAIVE,
-    RANDOM_CARTESIAN_DISCARD,
-    RANDOM_SPHERICAL_NAIVE,
-    RANDOM_SPHERICAL_LATITUDE,
-    RANDOM_CARTESIAN_CUBE,
-    DEMO_DUAL_COLOR_SLICE
+    float death_time = 0.f;
 };
 
+// Draws the particles of the engine, sending to the GPU only what each update changed.
 class particles {
 public:
     // TODO: Changes in program?
@@ -101,7 +48,8 @@ public:
         std::shared_ptr<glprogram> active_program,
         uint32_t max_number = 20000,
         particle_layout_type lt = particle_layout_type::RANDOM_CARTESIAN_CUBE,
-        bool stop_after_load = false);
+        bool stop_after_load = false,
+        partition_type pt = partition_type::GRID);
     ~particles();
 
     void set_particle_layout(particle_layout_type lt);
@@ -109,25 +57,40 @@ public:
     void update(float dt);
 
     void toggle_update_particles() {
-        m_update_particles = !m_update_particles;
+        m_engine.toggle_update_particles();
+    }
+
+    // Every how many updates the particles are reordered by bucket, 0 (the default) disables it.
+    void set_sort_interval(const uint32_t frames) {
+        m_engine.set_sort_interval(frames);
+    }
+
+    // Share of changed particles above which the whole buffer is uploaded instead of the changes.
+    void set_max_dirty_fraction(const float fraction) {
+        m_max_dirty_fraction = fraction;
     }
 
 private:
-    std::mt19937 m_generator{ std::random_device{}() };
-    std::uniform_real_distribution<float> m_dis01, m_dis11;
-    GLuint m_vao, m_vbo, m_ebo;
-    particle_layout_type m_lt;
-    std::vector<particle_render_data> m_particles_render_data;
-    std::vector<particle_data> m_particles_data;
-    std::shared_ptr<spp> m_optimizer;
-    bool m_update_particles = true;
-    bool m_stop_after_load;
-    uint32_t m_max_density = 1;
+    particle_engine m_engine;
+    // Ring of vertex buffers: the one written each frame was last drawn k_vbo_count - 1 frames ago,
+    // its fence tells when the GPU is done with it.
+    static constexpr size_t k_vbo_count = 3;
+    GLuint m_vao, m_ebo;
+    std::array<GLuint, k_vbo_count> m_vbos;
+    std::array<GLsync, k_vbo_count> m_fences{};
+    size_t m_vbo_index = 0;
+    std::array<std::vector<size_t>, k_vbo_count> m_pending; // Changed slots each buffer still misses.
+    std::array<bool, k_vbo_count> m_pending_full;
+    GLint m_pos_attrib, m_dens_attrib, m_death_attrib;
+    std::vector<particle_render_data> m_render_data; // Interleaved copy of the particles for the upload.
+    float m_max_dirty_fraction;
 
-    void init_particles();
-    void gen_particle_position(size_t index);
     void setup_gl(std::shared_ptr<glprogram> active_program);
-    void update_colors_optimizer(const std::vector<size_t>& updated_indices);
+    void pack_render_data(size_t begin, size_t end);
+    void bind_vertex_buffer(size_t vbo_index);
+    void wait_vertex_buffer(size_t vbo_index);
+    // Sends the particles touched in the last update, or all of them, and the live list to draw.
+    void upload_render_data();
 };
 
 #endif // _PARTICLES_H_
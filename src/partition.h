@@ -0,0 +1,77 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _PARTITION_H_
+#define _PARTITION_H_
+#include "cell_storage.h"
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Contract shared by the space partitions used to find neighboring particles. Particles are put in
+// buckets by position, and the area of a bucket holds every bucket where a particle closer than the
+// partition radius to one in it could be.
+class partition {
+public:
+    using cell_id = uint64_t;
+    using bucket_view = cell_storage::bucket_view;
+    static constexpr cell_id k_invalid_cell = ~cell_id{ 0 };
+
+    // Non owning reference to a callable taking a cell_id, so visiting an area never allocates.
+    class bucket_visitor {
+    public:
+        template <typename F>
+        bucket_visitor(const F& f)
+            : m_callable(&f)
+            , m_call(&call<F>) {}
+
+        void operator()(cell_id bucket_id) const { m_call(m_callable, bucket_id); }
+    private:
+        const void* m_callable;
+        void (*m_call)(const void*, cell_id);
+
+        template <typename F>
+        static void call(const void* callable, const cell_id bucket_id) {
+            (*static_cast<const F*>(callable))(bucket_id);
+        }
+    };
+
+    virtual ~partition() = default;
+
+    virtual cell_id add(const glm::vec3& pos, size_t external_idx) = 0;
+    virtual void remove(cell_id bucket_id, size_t external_idx) = 0;
+    virtual bucket_view get_bucket(cell_id bucket_id) const = 0;
+    // Calls visit once for every non empty bucket in the area of bucket_id, itself included.
+    virtual void visit_buckets_area(cell_id bucket_id, const bucket_visitor& visit) const = 0;
+    // Index of the bucket's cell in storage. Buckets taken in this order are read in memory order.
+    virtual size_t get_storage_index(cell_id bucket_id) const = 0;
+
+    // Drops the current contents and bulk loads positions[i] as external_idxs[i]. Returns each
+    // entry's bucket id.
+    virtual std::vector<cell_id> rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) = 0;
+    // Whether a rebuild is expected to be cheaper than changed_count incremental add/remove calls.
+    virtual bool should_rebuild(size_t changed_count) const = 0;
+    virtual size_t size() const = 0;
+};
+
+#endif // _PARTITION_H_
@@ -23,60 +23,99 @@ SOFTWARE.
 #include "spp.h"
 #include <simple-assert.h>
 #include <algorithm>
-#include <array>
 #include <cmath>
 
-spp::spp(const uint8_t intervals_per_axis, const float min_val, const float max_val)
-    : m_intervals_per_axis(intervals_per_axis)
+// Taken by reference by std::min, needs a definition.
+constexpr uint32_t spp::k_max_dense_intervals_per_axis;
+
+using cell_key::pack;
+using cell_key::unpack;
+
+// Spreads the lower 21 bits of value so there are two zero bits between each of them.
+static uint64_t spread_bits(const uint32_t value) {
+    uint64_t x = value & 0x1FFFFF;
+    x = (x | x << 32) & 0x1F00000000FFFFull;
+    x = (x | x << 16) & 0x1F0000FF0000FFull;
+    x = (x | x << 8) & 0x100F00F00F00F00Full;
+    x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+// Inverse of a two way interleave: keeps the even bits of value, packed together.
+static uint32_t compact_even_bits(const uint64_t value) {
+    uint64_t x = value & 0x5555555555555555ull;
+    x = (x | x >> 1) & 0x3333333333333333ull;
+    x = (x | x >> 2) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | x >> 4) & 0x00FF00FF00FF00FFull;
+    x = (x | x >> 8) & 0x0000FFFF0000FFFFull;
+    x = (x | x >> 16) & 0x00000000FFFFFFFFull;
+    return static_cast<uint32_t>(x);
+}
+static uint64_t morton(const uint32_t x, const uint32_t y, const uint32_t z) {
+    return spread_bits(x) << 2 | spread_bits(y) << 1 | spread_bits(z);
+}
+static size_t cell_count(const uint32_t intervals_per_axis, const spp::cell_order order) {
+    // Checked here, the cell array is allocated before the constructor body runs.
+    SPL_ASSERT(intervals_per_axis > 0 && intervals_per_axis <= spp::k_max_dense_intervals_per_axis, "SPP intervals don't fit the dense cell array.");
+    size_t side = intervals_per_axis;
+    if (order == spp::cell_order::MORTON) {
+        // Z-order covers a power of two sided cube, the cells past the last interval stay empty.
+        side = 1;
+        while (side < intervals_per_axis) {
+            side <<= 1;
+        }
+    }
+    return side * side * side;
+}
+
+spp::spp(const uint32_t intervals_per_axis, const float min_val, const float max_val, const cell_order order, const cell_content content)
+    : m_storage(cell_count(intervals_per_axis, order), content == cell_content::POSITIONS)
+    , m_intervals_per_axis(intervals_per_axis)
+    , m_order(order)
     , m_min_vec{ min_val, min_val, min_val }
     , m_normalize_value(max_val - min_val) {
     SPL_ASSERT(m_normalize_value != 0., "SPP interval can't be zero.");
     SPL_ASSERT(max_val > min_val, "Consider swapping min and max!");
 }
 
-uint32_t spp::add(const glm::vec3& pos, const size_t external_idx) {
+spp::cell_id spp::add(const glm::vec3& pos, const size_t external_idx) {
     const auto bid = get_bucket(pos);
-    m_buckets[bid].push_back(external_idx);
+    m_storage.add(get_cell_index(bid), external_idx, pos);
     return bid;
 }
 void spp::remove(const glm::vec3& pos, const size_t external_idx) {
     remove(get_bucket(pos), external_idx);
 }
-void spp::remove(const uint32_t bucket_id, const size_t external_idx) {
-    auto& b = m_buckets[bucket_id];
-    b.erase(std::find(b.begin(), b.end(), external_idx));
+void spp::remove(const cell_id bucket_id, const size_t external_idx) {
+    m_storage.remove(get_cell_index(bucket_id), external_idx);
 }
 
-std::vector<uint32_t> spp::get_buckets_area(const glm::vec3& pos) const {
+spp::bucket_area spp::get_buckets_area(const glm::vec3& pos) const {
     return get_buckets_area(get_bucket(pos));
 }
 
-static uint32_t pack(const uint8_t x, const uint8_t y, const uint8_t z) {
-    return  x << 16 | y << 8 | z;
-}
-static std::array<uint8_t, 3> unpack(uint32_t value) {
-    return {{
-        static_cast<uint8_t>((value >> 16) & 0xFF),
-        static_cast<uint8_t>((value >> 8) & 0xFF),
-        static_cast<uint8_t>(value & 0xFF)
-    }};
+spp::bucket_area spp::get_buckets_area(const cell_id bucket_id) const {
+    bucket_area buckets;
+    get_buckets_area(bucket_id, buckets);
+    return buckets;
 }
-std::vector<uint32_t> spp::get_buckets_area(const uint32_t bucket_id) const {
-    std::vector<uint32_t> buckets;
-    buckets.reserve(3 * 3 * 3); // Max adjacent buckets (think of a rubik's cube)
+
+void spp::get_buckets_area(const cell_id bucket_id, bucket_area& out) const {
+    out.count = 0;
     const auto unpacked = unpack(bucket_id);
-    for (int8_t ix = -1; ix < 2; ix++) {
-        const int8_t xval = unpacked[0] + ix;
-        if (xval >= 0 && xval < m_intervals_per_axis) {
-            for (int8_t iy = -1; iy < 2; iy++) {
-                const int8_t yval = unpacked[1] + iy;
-                if (yval >= 0 && yval < m_intervals_per_axis) {
-                    for (int8_t iz = -1; iz < 2; iz++) {
-                        const int8_t zval = unpacked[2] + iz;
-                        if (zval >= 0 && zval < m_intervals_per_axis) {
-                            const auto potential_id = pack(xval, yval, zval);
-                            if (m_buckets.find(potential_id) != m_buckets.end()) {
-                                buckets.push_back(potential_id);
+    const int64_t intervals = m_intervals_per_axis;
+    for (int64_t ix = -1; ix < 2; ix++) {
+        const int64_t xval = unpacked[0] + ix;
+        if (xval >= 0 && xval < intervals) {
+            for (int64_t iy = -1; iy < 2; iy++) {
+                const int64_t yval = unpacked[1] + iy;
+                if (yval >= 0 && yval < intervals) {
+                    for (int64_t iz = -1; iz < 2; iz++) {
+                        const int64_t zval = unpacked[2] + iz;
+                        if (zval >= 0 && zval < intervals) {
+                            const auto potential_id = pack(static_cast<uint32_t>(xval), static_cast<uint32_t>(yval), static_cast<uint32_t>(zval));
+                            if (m_storage.count(get_cell_index(potential_id)) != 0) {
+                                out.ids[out.count++] = potential_id;
                             }
                         }
                     }
@@ -84,23 +123,108 @@ std::vector<uint32_t> spp::get_buckets_area(const uint32_t bucket_id) const {
             }
         }
     }
-    return buckets;
 }
 
-const std::vector<size_t>& spp::get_bucket(const uint32_t bucket_id) const {
-    const auto& pair = m_buckets.find(bucket_id);
-    SPL_ASSERT(pair != m_buckets.end(), "The bucket was not found");
+void spp::visit_buckets_area(const cell_id bucket_id, const bucket_visitor& visit) const {
+    bucket_area buckets;
+    get_buckets_area(bucket_id, buckets);
+    for (auto id : buckets) {
+        visit(id);
+    }
+}
+
+void spp::get_forward_buckets_area(const cell_id bucket_id, bucket_area& out) const {
+    out.count = 0;
+    const auto unpacked = unpack(bucket_id);
+    const int64_t intervals = m_intervals_per_axis;
+    for (int64_t ix = 0; ix < 2; ix++) {
+        const int64_t xval = unpacked[0] + ix;
+        // With the same x only higher y count, with the same x and y only higher z.
+        for (int64_t iy = (ix == 0) ? 0 : -1; iy < 2; iy++) {
+            const int64_t yval = unpacked[1] + iy;
+            for (int64_t iz = (ix == 0 && iy == 0) ? 0 : -1; iz < 2; iz++) {
+                const int64_t zval = unpacked[2] + iz;
+                if (xval < intervals && yval >= 0 && yval < intervals && zval >= 0 && zval < intervals) {
+                    const auto potential_id = pack(static_cast<uint32_t>(xval), static_cast<uint32_t>(yval), static_cast<uint32_t>(zval));
+                    if (m_storage.count(get_cell_index(potential_id)) != 0) {
+                        out.ids[out.count++] = potential_id;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void spp::visit_layer(const uint32_t x, const bucket_visitor& visit) const {
+    SPL_ASSERT(x < m_intervals_per_axis, "The layer is not within SPP bounds.");
+    if (m_order == cell_order::MORTON) {
+        // With x fixed the cells follow in memory as (y, z) interleaved, y on the odd bits. The
+        // power of two side can go past the last interval, those cells are skipped.
+        size_t side = 1;
+        while (side < m_intervals_per_axis) {
+            side <<= 1;
+        }
+        for (uint64_t yz = 0; yz < side * side; yz++) {
+            const auto y = compact_even_bits(yz >> 1);
+            const auto z = compact_even_bits(yz);
+            if (y < m_intervals_per_axis && z < m_intervals_per_axis) {
+                const auto bucket_id = pack(x, y, z);
+                if (m_storage.count(get_cell_index(bucket_id)) != 0) {
+                    visit(bucket_id);
+                }
+            }
+        }
+        return;
+    }
+    for (uint32_t y = 0; y < m_intervals_per_axis; y++) {
+        for (uint32_t z = 0; z < m_intervals_per_axis; z++) {
+            const auto bucket_id = pack(x, y, z);
+            if (m_storage.count(get_cell_index(bucket_id)) != 0) {
+                visit(bucket_id);
+            }
+        }
+    }
+}
+
+spp::bucket_view spp::get_bucket(const cell_id bucket_id) const {
+    return m_storage.get(get_cell_index(bucket_id));
+}
+
+std::vector<spp::cell_id> spp::rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) {
+    std::vector<cell_id> bucket_ids(positions.size());
+    std::vector<size_t> cell_idxs(positions.size());
+    for (size_t ix = 0; ix < positions.size(); ix++) {
+        bucket_ids[ix] = get_bucket(positions[ix]);
+        cell_idxs[ix] = get_cell_index(bucket_ids[ix]);
+    }
+    m_storage.rebuild(cell_idxs, external_idxs, positions);
+    return bucket_ids;
+}
 
-    return pair->second;
+bool spp::should_rebuild(const size_t changed_count) const {
+    return m_storage.should_rebuild(changed_count);
 }
 
-uint32_t spp::get_bucket(const glm::vec3& pos) const {
+spp::cell_id spp::get_bucket(const glm::vec3& pos) const {
     SPL_ASSERT(pos.x <= m_min_vec.x + m_normalize_value && pos.x >= m_min_vec.x, "pos.x is not within SPP bounds.");
     SPL_ASSERT(pos.y <= m_min_vec.y + m_normalize_value && pos.y >= m_min_vec.y, "pos.y is not within SPP bounds.");
     SPL_ASSERT(pos.z <= m_min_vec.z + m_normalize_value && pos.z >= m_min_vec.z, "pos.z is not within SPP bounds.");
     const auto norm = (pos - m_min_vec) / m_normalize_value;
+    // The max value would fall one past the last interval, keep it inside.
+    const auto last = static_cast<float>(m_intervals_per_axis - 1);
     return pack(
-        static_cast<uint8_t>(std::floor(m_intervals_per_axis * norm.x)),
-        static_cast<uint8_t>(std::floor(m_intervals_per_axis * norm.y)),
-        static_cast<uint8_t>(std::floor(m_intervals_per_axis * norm.z)));
+        static_cast<uint32_t>(std::min(last, std::floor(m_intervals_per_axis * norm.x))),
+        static_cast<uint32_t>(std::min(last, std::floor(m_intervals_per_axis * norm.y))),
+        static_cast<uint32_t>(std::min(last, std::floor(m_intervals_per_axis * norm.z))));
+}
+
+size_t spp::get_cell_index(const cell_id bucket_id) const {
+    const auto unpacked = unpack(bucket_id);
+    SPL_ASSERT(unpacked[0] < m_intervals_per_axis && unpacked[1] < m_intervals_per_axis && unpacked[2] < m_intervals_per_axis,
+        "The bucket is not within SPP bounds.");
+    if (m_order == cell_order::MORTON) {
+        return static_cast<size_t>(morton(unpacked[0], unpacked[1], unpacked[2]));
+    }
+    const size_t n = m_intervals_per_axis;
+    return (static_cast<size_t>(unpacked[0]) * n + unpacked[1]) * n + unpacked[2];
 }
@@ -22,31 +22,86 @@ SOFTWARE.
 
 #ifndef _SPP_H_
 #define _SPP_H_
+#include "cell_key.h"
+#include "cell_storage.h"
+#include "partition.h"
 #include <glm/vec3.hpp>
-#include <set>
-#include <unordered_map>
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 // Space Partitioned Positions!
-class spp {
+// A uniform grid over a cube, cells live in a dense array indexed by their (x, y, z) coordinates.
+class spp : public partition {
 public:
-    spp(uint8_t intervals_per_axis, float min_val, float max_val);
+    // Cell ids pack the cell coordinates, k_axis_bits per axis.
+    static constexpr uint32_t k_axis_bits = cell_key::k_axis_bits;
+    static constexpr uint32_t k_max_intervals_per_axis = cell_key::k_max_value;
+    // The cell array is dense, intervals^3 cells of 12 bytes whether they hold particles or not
+    // (with MORTON each side is rounded up to a power of two). 512 per axis is already 1.5 GiB, so
+    // the ids have room to spare and this is the actual limit.
+    static constexpr uint32_t k_max_dense_intervals_per_axis = 512;
+
+    // Order of the cells in memory. MORTON interleaves the coordinate bits (Z-order), so
+    // neighboring cells and their pool ranges end up close together.
+    enum class cell_order : short {
+        LINEAR,
+        MORTON
+    };
+
+    // What a cell keeps per particle. With POSITIONS a copy of the position sits next to each index,
+    // so scanning a bucket reads contiguous coordinates (bucket_view::x, y and z).
+    enum class cell_content : short {
+        INDICES,
+        POSITIONS
+    };
+
+    // Non empty buckets around (and including) a given one, bounded by the adjacent cells of a 3x3x3 block.
+    struct bucket_area {
+        static constexpr size_t k_capacity = 3 * 3 * 3;
+        std::array<cell_id, k_capacity> ids;
+        size_t count = 0;
+
+        const cell_id* begin() const { return ids.data(); }
+        const cell_id* end() const { return ids.data() + count; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+    };
+
+    spp(uint32_t intervals_per_axis, float min_val, float max_val, cell_order order = cell_order::LINEAR, cell_content content = cell_content::INDICES);
     ~spp() = default;
 
-    uint32_t add(const glm::vec3& pos, size_t external_idx);
+    cell_id add(const glm::vec3& pos, size_t external_idx) override;
     void remove(const glm::vec3& pos, size_t external_idx);
-    void remove(uint32_t bucket_id, size_t external_idx);
-    std::vector<uint32_t> get_buckets_area(const glm::vec3& pos) const;
-    std::vector<uint32_t> get_buckets_area(uint32_t bucket_id) const;
-    const std::vector<size_t>& get_bucket(uint32_t bucket_id) const;
+    void remove(cell_id bucket_id, size_t external_idx) override;
+    bucket_area get_buckets_area(const glm::vec3& pos) const;
+    bucket_area get_buckets_area(cell_id bucket_id) const;
+    void get_buckets_area(cell_id bucket_id, bucket_area& out) const;
+    void visit_buckets_area(cell_id bucket_id, const bucket_visitor& visit) const override;
+    bucket_view get_bucket(cell_id bucket_id) const override;
+    size_t get_storage_index(cell_id bucket_id) const override { return get_cell_index(bucket_id); }
+
+    // Non empty buckets of the half stencil of bucket_id: itself plus the 13 neighbors after it in
+    // (x, y, z) order. Walking every bucket against its half stencil meets each pair of adjacent
+    // buckets once, and only reaches buckets with the same or the next x.
+    void get_forward_buckets_area(cell_id bucket_id, bucket_area& out) const;
+    // Calls visit for every non empty bucket with the given x, in memory order.
+    void visit_layer(uint32_t x, const bucket_visitor& visit) const;
+    uint32_t get_intervals_per_axis() const { return m_intervals_per_axis; }
+
+    std::vector<cell_id> rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) override;
+    bool should_rebuild(size_t changed_count) const override;
+    size_t size() const override { return m_storage.size(); }
 private:
-    std::unordered_map<uint32_t, std::vector<size_t>> m_buckets;
-    uint8_t m_intervals_per_axis;
+    cell_storage m_storage;
+    uint32_t m_intervals_per_axis;
+    cell_order m_order;
     glm::vec3 m_min_vec;
     float m_normalize_value;
 
-    uint32_t get_bucket(const glm::vec3& pos) const;
+    cell_id get_bucket(const glm::vec3& pos) const;
+    size_t get_cell_index(cell_id bucket_id) const;
 };
 
 #endif // _SPP_H_
@@ -0,0 +1,157 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "sspp.h"
+#include "cell_key.h"
+#include <simple-assert.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <initializer_list>
+
+static const uint32_t k_face_count = 6;
+static const float k_quarter_pi = 0.785398163397448309616f;
+// The narrowest cells of an equal angle cube map sit at the middle of the face edges, where they
+// span 1/sqrt(2) of their nominal angle. Rounded down to keep the whole neighborhood in the area.
+static const float k_min_cell_width = .7f;
+
+// Ids pack (face, u, v).
+using cell_key::pack;
+using cell_key::unpack;
+// Faces are numbered 2 * major axis + (1 if the major coordinate is negative), the face
+// coordinates are the two other axes in cyclic order.
+static glm::vec3 face_point(const uint32_t face, const float tan_u, const float tan_v) {
+    const auto axis = face / 2;
+    glm::vec3 point;
+    point[axis] = (face % 2 == 0) ? 1.f : -1.f;
+    point[(axis + 1) % 3] = tan_u;
+    point[(axis + 2) % 3] = tan_v;
+    return point;
+}
+
+static uint32_t get_interval_count(const float radius) {
+    // Angle subtended by a chord of length radius.
+    const auto angle = 2.f * std::asin(std::min(1.f, radius / 2.f));
+    const auto intervals = static_cast<uint32_t>(std::floor(2.f * k_quarter_pi * k_min_cell_width / angle));
+    // Areas spread at most one face away with two intervals, fewer would miss close pairs.
+    SPL_ASSERT(intervals >= 2, "SSPP radius too large for the cube map.");
+    return std::min(intervals, cell_key::k_max_value - 1);
+}
+
+sspp::sspp(const float radius)
+    : m_intervals_per_axis(get_interval_count(radius))
+    , m_storage(static_cast<size_t>(k_face_count) * m_intervals_per_axis * m_intervals_per_axis) {
+    SPL_ASSERT(radius > 0.f, "SSPP radius has to be positive.");
+}
+
+sspp::cell_id sspp::add(const glm::vec3& pos, const size_t external_idx) {
+    const auto bid = get_bucket(pos);
+    m_storage.add(get_cell_index(bid), external_idx);
+    return bid;
+}
+
+void sspp::remove(const cell_id bucket_id, const size_t external_idx) {
+    m_storage.remove(get_cell_index(bucket_id), external_idx);
+}
+
+void sspp::visit_buckets_area(const cell_id bucket_id, const bucket_visitor& visit) const {
+    std::array<cell_id, 3 * 3 * 3> buckets;
+    size_t count = 0;
+    const auto add_unique = [&buckets, &count](const cell_id id) {
+        if (std::find(buckets.begin(), buckets.begin() + count, id) == buckets.begin() + count) {
+            SPL_ASSERT(count < buckets.size(), "Too many buckets around a cube map corner.");
+            buckets[count++] = id;
+        }
+    };
+
+    const auto unpacked = unpack(bucket_id);
+    const int64_t intervals = m_intervals_per_axis;
+    const float interval_angle = 2.f * k_quarter_pi / m_intervals_per_axis;
+    for (int64_t iu = -1; iu < 2; iu++) {
+        const int64_t uval = unpacked[1] + iu;
+        for (int64_t iv = -1; iv < 2; iv++) {
+            const int64_t vval = unpacked[2] + iv;
+            if (uval >= 0 && uval < intervals && vval >= 0 && vval < intervals) {
+                add_unique(pack(unpacked[0], static_cast<uint32_t>(uval), static_cast<uint32_t>(vval)));
+            } else {
+                // Past the face edge, extend the face plane and sample the virtual cell to find which
+                // cells of the adjacent faces it covers.
+                for (auto su : { .05f, .5f, .95f }) {
+                    for (auto sv : { .05f, .5f, .95f }) {
+                        const auto u_angle = (uval + su) * interval_angle - k_quarter_pi;
+                        const auto v_angle = (vval + sv) * interval_angle - k_quarter_pi;
+                        add_unique(get_bucket(face_point(unpacked[0], std::tan(u_angle), std::tan(v_angle))));
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t ix = 0; ix < count; ix++) {
+        if (m_storage.count(get_cell_index(buckets[ix])) != 0) {
+            visit(buckets[ix]);
+        }
+    }
+}
+
+sspp::bucket_view sspp::get_bucket(const cell_id bucket_id) const {
+    return m_storage.get(get_cell_index(bucket_id));
+}
+
+std::vector<sspp::cell_id> sspp::rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) {
+    std::vector<cell_id> bucket_ids(positions.size());
+    std::vector<size_t> cell_idxs(positions.size());
+    for (size_t ix = 0; ix < positions.size(); ix++) {
+        bucket_ids[ix] = get_bucket(positions[ix]);
+        cell_idxs[ix] = get_cell_index(bucket_ids[ix]);
+    }
+    m_storage.rebuild(cell_idxs, external_idxs);
+    return bucket_ids;
+}
+
+bool sspp::should_rebuild(const size_t changed_count) const {
+    return m_storage.should_rebuild(changed_count);
+}
+
+sspp::cell_id sspp::get_bucket(const glm::vec3& pos) const {
+    const glm::vec3 abs_pos{ std::abs(pos.x), std::abs(pos.y), std::abs(pos.z) };
+    const uint32_t axis = (abs_pos.x >= abs_pos.y && abs_pos.x >= abs_pos.z) ? 0 : (abs_pos.y >= abs_pos.z ? 1 : 2);
+    SPL_ASSERT(abs_pos[axis] > 0.f, "SSPP can't place the sphere center.");
+    const uint32_t face = 2 * axis + (pos[axis] < 0.f ? 1 : 0);
+
+    const auto last = static_cast<float>(m_intervals_per_axis - 1);
+    const auto interval = [this, last](const float tangent) {
+        const auto norm = (std::atan(tangent) / k_quarter_pi + 1.f) * .5f;
+        return static_cast<uint32_t>(std::max(0.f, std::min(last, std::floor(m_intervals_per_axis * norm))));
+    };
+    return pack(face,
+        interval(pos[(axis + 1) % 3] / abs_pos[axis]),
+        interval(pos[(axis + 2) % 3] / abs_pos[axis]));
+}
+
+size_t sspp::get_cell_index(const cell_id bucket_id) const {
+    const auto unpacked = unpack(bucket_id);
+    SPL_ASSERT(unpacked[0] < k_face_count && unpacked[1] < m_intervals_per_axis && unpacked[2] < m_intervals_per_axis,
+        "The bucket is not within SSPP bounds.");
+    const size_t n = m_intervals_per_axis;
+    return (unpacked[0] * n + unpacked[1]) * n + unpacked[2];
+}
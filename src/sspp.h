@@ -0,0 +1,58 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _SSPP_H_
+#define _SSPP_H_
+#include "cell_storage.h"
+#include "partition.h"
+#include <glm/vec3.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sphere Surface Partitioned Positions!
+// Cube map tiling of the unit sphere, for particles constrained to its surface. Every face is split
+// in equal angle intervals, so cells cover similar areas and hold similar amounts of particles.
+class sspp : public partition {
+public:
+    // radius is the distance between neighbors that the buckets area has to cover.
+    explicit sspp(float radius);
+    ~sspp() = default;
+
+    cell_id add(const glm::vec3& pos, size_t external_idx) override;
+    void remove(cell_id bucket_id, size_t external_idx) override;
+    void visit_buckets_area(cell_id bucket_id, const bucket_visitor& visit) const override;
+    bucket_view get_bucket(cell_id bucket_id) const override;
+    size_t get_storage_index(cell_id bucket_id) const override { return get_cell_index(bucket_id); }
+
+    std::vector<cell_id> rebuild(const std::vector<glm::vec3>& positions, const std::vector<size_t>& external_idxs) override;
+    bool should_rebuild(size_t changed_count) const override;
+    size_t size() const override { return m_storage.size(); }
+private:
+    uint32_t m_intervals_per_axis;
+    cell_storage m_storage;
+
+    cell_id get_bucket(const glm::vec3& pos) const;
+    size_t get_cell_index(cell_id bucket_id) const;
+};
+
+#endif // _SSPP_H_
@@ -0,0 +1,188 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "thread_pool.h"
+#include <algorithm>
+#include <numeric>
+
+thread_pool::thread_pool(const uint32_t worker_count, const idle_policy policy)
+    : m_queues(worker_count + 1)
+    , m_policy(policy) {
+    for (auto ix = 0u; ix < worker_count; ix++) {
+        m_workers.push_back(std::thread(&thread_pool::worker_loop, this, ix));
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+uint32_t thread_pool::default_worker_count() {
+    const auto hw = std::thread::hardware_concurrency();
+    return hw > 1u ? hw - 1u : 0u;
+}
+
+void thread_pool::split_by_cost(const std::vector<uint32_t>& costs, const size_t chunk_count, std::vector<size_t>& bounds) {
+    bounds.clear();
+    bounds.push_back(0);
+    if (costs.empty()) {
+        return;
+    }
+    const auto total = std::accumulate(costs.begin(), costs.end(), uint64_t{ 0 });
+    const auto target = std::max<uint64_t>(1, total / std::max<size_t>(1, chunk_count));
+    uint64_t accumulated = 0;
+    for (size_t ix = 0; ix < costs.size(); ix++) {
+        accumulated += costs[ix];
+        if (accumulated >= target) {
+            bounds.push_back(ix + 1);
+            accumulated = 0;
+        }
+    }
+    if (bounds.back() != costs.size()) {
+        bounds.push_back(costs.size());
+    }
+}
+
+void thread_pool::run(const size_t count, const size_t grain, const size_t* const bounds, const range_task task) {
+    if (count == 0) {
+        return;
+    }
+    const auto chunk_grain = std::max<size_t>(1, grain);
+    // With bounds, count is already the amount of chunks.
+    const auto chunk_count = bounds ? count : (count + chunk_grain - 1) / chunk_grain;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = task;
+        m_count = count;
+        m_grain = chunk_grain;
+        m_bounds = bounds;
+        // Every thread starts with a contiguous share of the chunks.
+        const auto queue_count = m_queues.size();
+        for (size_t qx = 0; qx < queue_count; qx++) {
+            std::lock_guard<std::mutex> queue_lock(m_queues[qx].lock);
+            m_queues[qx].front = qx * chunk_count / queue_count;
+            m_queues[qx].back = (qx + 1) * chunk_count / queue_count;
+        }
+        m_active = get_worker_count();
+        m_generation++;
+    }
+    if (m_policy == idle_policy::SLEEP) {
+        m_wake.notify_all();
+    }
+
+    work(get_worker_count());
+
+    // Every worker checks in once per loop, so the next one can't start while any is still busy.
+    if (m_policy == idle_policy::SPIN) {
+        while (m_active != 0) {
+            std::this_thread::yield();
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_active == 0; });
+    }
+}
+
+void thread_pool::worker_loop(const uint32_t queue_idx) {
+    uint64_t seen = 0;
+    while (true) {
+        if (m_policy == idle_policy::SPIN) {
+            while (m_generation == seen && !m_stop) {
+                std::this_thread::yield();
+            }
+        } else {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen]() { return m_stop || m_generation != seen; });
+        }
+        if (m_stop) {
+            return;
+        }
+        seen = m_generation;
+
+        work(queue_idx);
+
+        if (--m_active == 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done.notify_all();
+        }
+    }
+}
+
+void thread_pool::work(const uint32_t queue_idx) {
+    // No chunks are created while running, once nothing is left to steal everything is taken.
+    size_t chunk;
+    while (pop(queue_idx, chunk) || steal(queue_idx, chunk)) {
+        run_chunk(chunk);
+    }
+}
+
+bool thread_pool::pop(const uint32_t queue_idx, size_t& chunk) {
+    auto& queue = m_queues[queue_idx];
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.front == queue.back) {
+        return false;
+    }
+    chunk = queue.front++;
+    return true;
+}
+
+bool thread_pool::steal(const uint32_t queue_idx, size_t& chunk) {
+    const auto queue_count = static_cast<uint32_t>(m_queues.size());
+    for (uint32_t offset = 1; offset < queue_count; offset++) {
+        auto& victim = m_queues[(queue_idx + offset) % queue_count];
+        size_t first, last;
+        {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            const auto left = victim.back - victim.front;
+            if (left == 0) {
+                continue;
+            }
+            last = victim.back;
+            first = last - (left + 1) / 2;
+            victim.back = first;
+        }
+        // Run the first stolen chunk right away and keep the rest, up for stealing again.
+        auto& own = m_queues[queue_idx];
+        std::lock_guard<std::mutex> lock(own.lock);
+        own.front = first + 1;
+        own.back = last;
+        chunk = first;
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::run_chunk(const size_t chunk) const {
+    if (m_bounds) {
+        m_task.call(m_task.callable, m_bounds[chunk], m_bounds[chunk + 1]);
+    } else {
+        const auto begin = chunk * m_grain;
+        m_task.call(m_task.callable, begin, std::min(begin + m_grain, m_count));
+    }
+}
@@ -0,0 +1,112 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+#include <non-copyable.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long lived workers running parallel loops, so no threads are created or joined per frame.
+// A loop is cut in chunks, every thread starts with a contiguous share of them and, once done with
+// its own, steals half of what is left to some other thread.
+class thread_pool : public patterns::Non_Copyable {
+public:
+    // What idle workers do while waiting for work: block on a condition variable, or spin
+    // (yielding) to pick up the next loop without the wake up latency.
+    enum class idle_policy : short {
+        SLEEP,
+        SPIN
+    };
+
+    // By default one worker per hardware thread but the caller's, which also works on every loop.
+    explicit thread_pool(uint32_t worker_count = default_worker_count(), idle_policy policy = idle_policy::SLEEP);
+    ~thread_pool();
+
+    // Calls fn(begin, end) over consecutive ranges of at most grain indices covering [0, count),
+    // and returns once all of them are done. Not reentrant.
+    template <typename F>
+    void parallel_for(size_t count, size_t grain, const F& fn) {
+        run(count, grain, nullptr, range_task{ &fn, &call<F> });
+    }
+    // Same, but the ranges are [bounds[i], bounds[i + 1]).
+    template <typename F>
+    void parallel_for(const std::vector<size_t>& bounds, const F& fn) {
+        if (bounds.size() > 1) {
+            run(bounds.size() - 1, 0, bounds.data(), range_task{ &fn, &call<F> });
+        }
+    }
+
+    // Fills bounds with at most chunk_count + 1 indices cutting [0, costs.size()) in ranges of
+    // about the same total cost.
+    static void split_by_cost(const std::vector<uint32_t>& costs, size_t chunk_count, std::vector<size_t>& bounds);
+
+    uint32_t get_worker_count() const { return static_cast<uint32_t>(m_workers.size()); }
+    static uint32_t default_worker_count();
+private:
+    struct range_task {
+        const void* callable;
+        void (*call)(const void*, size_t, size_t);
+    };
+
+    template <typename F>
+    static void call(const void* callable, const size_t begin, const size_t end) {
+        (*static_cast<const F*>(callable))(begin, end);
+    }
+
+    // Chunks [front, back) still to be run by a thread, the owner pops the front and thieves take
+    // the back.
+    struct chunk_queue {
+        std::mutex lock;
+        size_t front = 0;
+        size_t back = 0;
+    };
+
+    std::vector<std::thread> m_workers;
+    std::vector<chunk_queue> m_queues; // One per worker, plus the caller's at the end.
+    idle_policy m_policy;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    std::atomic<uint64_t> m_generation{ 0 };
+    std::atomic<uint32_t> m_active{ 0 };
+    std::atomic<bool> m_stop{ false };
+
+    // Current loop, written before m_generation is bumped.
+    range_task m_task{ nullptr, nullptr };
+    size_t m_count = 0;
+    size_t m_grain = 1;
+    const size_t* m_bounds = nullptr;
+
+    void run(size_t count, size_t grain, const size_t* bounds, range_task task);
+    void worker_loop(uint32_t queue_idx);
+    void work(uint32_t queue_idx);
+    bool pop(uint32_t queue_idx, size_t& chunk);
+    bool steal(uint32_t queue_idx, size_t& chunk);
+    void run_chunk(size_t chunk) const;
+};
+
+#endif // _THREAD_POOL_H_
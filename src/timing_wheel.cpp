@@ -0,0 +1,104 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "timing_wheel.h"
+#include <simple-assert.h>
+#include <algorithm>
+#include <cmath>
+
+timing_wheel::timing_wheel(const float tick_length, const float horizon)
+    : m_tick_length(tick_length)
+    // One more slot, the current tick is partly in the past.
+    , m_slots(static_cast<size_t>(std::ceil(horizon / tick_length)) + 1) {
+    SPL_ASSERT(tick_length > 0.f && horizon > 0.f, "The wheel needs a positive tick length and horizon.");
+}
+
+void timing_wheel::add(const uint32_t idx, const float due_time) {
+    // Already due entries go to the current tick, drained on the next advance.
+    const auto tick = std::max(get_tick(due_time), m_next_tick);
+    SPL_ASSERT(tick < m_next_tick + m_slots.size(), "The due time is past the horizon.");
+    m_slots[tick % m_slots.size()].push_back(entry{ due_time, idx });
+    m_size++;
+}
+
+void timing_wheel::advance(const float now, std::vector<size_t>& expired) {
+    // Whole ticks before now, everything in them is due.
+    const auto now_tick = get_tick(now);
+    for (; m_next_tick < now_tick; m_next_tick++) {
+        auto& slot = m_slots[m_next_tick % m_slots.size()];
+        for (auto& e : slot) {
+            expired.push_back(e.idx);
+        }
+        m_size -= slot.size();
+        slot.clear();
+    }
+
+    // The current tick is only partly due.
+    auto& slot = m_slots[m_next_tick % m_slots.size()];
+    for (size_t eix = 0; eix < slot.size();) {
+        if (slot[eix].due_time <= now) {
+            expired.push_back(slot[eix].idx);
+            slot[eix] = slot.back();
+            slot.pop_back();
+            m_size--;
+        } else {
+            eix++;
+        }
+    }
+}
+
+void timing_wheel::clear() {
+    for (auto& slot : m_slots) {
+        slot.clear();
+    }
+    m_size = 0;
+}
+
+void timing_wheel::remap(const std::vector<size_t>& new_idxs) {
+    for (auto& slot : m_slots) {
+        for (auto& e : slot) {
+            e.idx = static_cast<uint32_t>(new_idxs[e.idx]);
+        }
+    }
+}
+
+float timing_wheel::rebase(const float now) {
+    const auto turn_ticks = static_cast<uint64_t>(m_slots.size());
+    const auto turns = get_tick(now) / turn_ticks;
+    if (turns == 0) {
+        return 0.f;
+    }
+    SPL_ASSERT(m_next_tick >= turns * turn_ticks, "Advance the wheel up to now before a rebase.");
+    const auto offset = static_cast<float>(turns * turn_ticks) * m_tick_length;
+    for (auto& slot : m_slots) {
+        for (auto& e : slot) {
+            e.due_time -= offset;
+        }
+    }
+    m_next_tick -= turns * turn_ticks;
+    return offset;
+}
+
+uint64_t timing_wheel::get_tick(const float time) const {
+    return static_cast<uint64_t>(std::max(0.f, time) / m_tick_length);
+}
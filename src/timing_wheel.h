@@ -0,0 +1,63 @@
+/**
+Copyright (c) 2016 Mariano Gonzalez
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _TIMING_WHEEL_H_
+#define _TIMING_WHEEL_H_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Queue of timed expirations bucketed by tick. Adding is O(1) and advancing the clock only touches
+// the ticks it goes over, so the cost follows the expirations and not the number of waiting entries.
+// Due times can't be further than the horizon from the current time.
+class timing_wheel {
+public:
+    timing_wheel(float tick_length, float horizon);
+    ~timing_wheel() = default;
+
+    void add(uint32_t idx, float due_time);
+    // Appends every entry due at or before now to expired, removing it from the wheel.
+    void advance(float now, std::vector<size_t>& expired);
+    void clear();
+    // Renames every entry idx as new_idxs[idx].
+    void remap(const std::vector<size_t>& new_idxs);
+    // Moves the origin of time forward to keep float times precise, returns the amount subtracted
+    // from every due time, which the owner has to subtract from its own times too. Always a whole
+    // number of wheel turns, so no entry changes its slot. The wheel has to be advanced up to now.
+    float rebase(float now);
+    size_t size() const { return m_size; }
+private:
+    struct entry {
+        float due_time;
+        uint32_t idx;
+    };
+
+    float m_tick_length;
+    std::vector<std::vector<entry>> m_slots;
+    uint64_t m_next_tick = 0; // First tick not drained yet.
+    size_t m_size = 0;
+
+    uint64_t get_tick(float time) const;
+};
+
+#endif // _TIMING_WHEEL_H_
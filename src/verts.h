@@ -42,9 +42,10 @@ namespace shaders {
             "uniform mat4 VP;                                          \n"
             "uniform uint Dual_Color_Demo;                             \n"
             "uniform float Inv_Max_Density;                            \n"
+            "uniform float Time;                                       \n"
             "in vec3 Position;                                         \n"
             "in float Density;                                         \n"
-            "in float Time_To_Death;                                   \n"
+            "in float Death_Time;                                      \n"
             "out vec4 Color;                                           \n"
             "                                                          \n"
             "float len2(vec3 v) {                                      \n"
@@ -53,7 +54,7 @@ namespace shaders {
             "                                                          \n"
             "void main() {                                             \n"
             "    gl_Position = VP * vec4(Position, 1.0);               \n"
-            "    float alive = float(Time_To_Death > 0.0);             \n"
+            "    float alive = float(Death_Time > Time);               \n"
             "    if (Dual_Color_Demo > 0u) {                           \n"
             "        float w = float(len2(Position) <= 1.0);           \n"
             "        float o = 1.0 - w;                                \n"